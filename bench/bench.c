@@ -0,0 +1,317 @@
+// bench.c
+//
+// Benchmarks of the port, timer and bus layers against the simulated chip,
+// so they run on any Linux box. Each result is compared with the baseline
+// file, and -s stores the results as the new baseline. Bus timing and write
+// strategy changes are checked against these numbers.
+//
+// Build from the top directory:
+//   gcc -O2 -I. -o ssebr2_bench bench/bench.c $(ls *.c | grep -v main.c) -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "getopt.h"
+#include "port.h"
+#include "utimer.h"
+#include "i2c_comm.h"
+#include "sim24c16.h"
+#include "wplan.h"
+#include "data/clean_K.h"
+
+#define BASELINE "bench/baseline.txt"
+#define TOLERANCE 20 /* percent worse than the baseline that counts as a regression */
+#define RUNS 7       /* repetitions, the median is reported */
+#define PORT 0x378
+#define CHIP_K 0x2c  /* chip select of the black cartridge */
+#define CHIP_16 0x20 /* 24C16 */
+
+typedef struct {
+	const char* name;
+	const char* unit;
+	int higherBetter;
+	double noise; /* differences up to this are not regressions */
+	double (*run)(void);
+	double value, baseline;
+} Bench;
+
+static I2CBus bus;
+static volatile int sink;
+
+static double nowNs() {
+	return (double)timerNanos();
+}
+
+static int cmpDouble(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void loadChip(const BYTE* image, int size) {
+	simLoad(PORT, image, size, 3);
+	i2c_select_chip(&bus, size > 512 ? CHIP_16 : CHIP_K);
+}
+
+/* port access */
+
+#define PORT_OPS 1000000
+
+static double benchOut() {
+	double t = nowNs();
+	int i;
+	for (i = 0; i < PORT_OPS; i++)
+		outp(bus.outPort, i2c_encode(&bus, 1, 1));
+	return (nowNs() - t) / PORT_OPS;
+}
+
+static double benchIn() {
+	double t = nowNs();
+	int i, x = 0;
+	for (i = 0; i < PORT_OPS; i++)
+		x += inp(bus.inPort);
+	sink = x;
+	return (nowNs() - t) / PORT_OPS;
+}
+
+/*
+ * timerWait: how late a wait ends after its deadline, the median and the
+ * 99th percentile. timerStart puts the deadline one phase from the call.
+ */
+
+#define WAITS 20000
+
+static double late[WAITS];
+
+static double waitLate(int ticks, int percentile) {
+	double t0, tick = 1000.0; // 1 MHz timer
+	int i;
+	for (i = 0; i < WAITS; i++) {
+		t0 = nowNs();
+		timerStart();
+		timerWait(ticks);
+		late[i] = nowNs() - t0 - ticks * tick;
+	}
+	qsort(late, WAITS, sizeof(late[0]), cmpDouble);
+	return late[WAITS / 100 * percentile];
+}
+
+static double benchShort() { return waitLate(bus.tShort, 50); }
+static double benchShort99() { return waitLate(bus.tShort, 99); }
+static double benchNorm() { return waitLate(bus.tNorm, 50); }
+static double benchNorm99() { return waitLate(bus.tNorm, 99); }
+
+/* bit rate of the bit-level primitives, ACK slots included */
+
+#define BYTES 256
+
+static double benchSendByte() {
+	double t;
+	int i;
+	loadChip(clean_K, 512);
+	i2c_start(&bus);
+	i2c_send_byte(&bus, 0x80 | CHIP_K);
+	i2c_send_byte(&bus, 0);
+	t = nowNs();
+	for (i = 0; i < BYTES; i++)
+		i2c_send_byte(&bus, clean_K[i & 15]); // wraps within the first page
+	t = nowNs() - t;
+	i2c_stop(&bus);
+	i2c_wait_write(&bus);
+	return BYTES * 9 / t * 1e9;
+}
+
+static double benchRecvByte() {
+	double t;
+	int i;
+	loadChip(clean_K, 512);
+	i2c_start(&bus);
+	i2c_send_byte(&bus, 0x80 | CHIP_K);
+	i2c_send_byte(&bus, 0);
+	i2c_start(&bus);
+	i2c_send_byte(&bus, 0x81 | CHIP_K);
+	t = nowNs();
+	for (i = 0; i < BYTES; i++) {
+		i2c_recv_byte(&bus, 0);
+		i2c_send_bit(&bus, i == BYTES - 1);
+	}
+	t = nowNs() - t;
+	i2c_stop(&bus);
+	return BYTES * 9 / t * 1e9;
+}
+
+/* end to end */
+
+static BYTE image[SIM_MAX_SIZE], buf[SIM_MAX_SIZE];
+
+static double readAll(int size) {
+	double t;
+	memset(image, 0x5a, sizeof(image));
+	memcpy(image, clean_K, 512);
+	loadChip(image, size);
+	t = nowNs();
+	if (i2c_read_bytes(&bus, 0, buf, size) != size || memcmp(buf, image, size))
+		fprintf(stderr, "read of %d bytes failed\n", size);
+	return (nowNs() - t) / 1e6;
+}
+
+static double benchRead512() { return readAll(512); }
+static double benchRead2048() { return readAll(SIM_MAX_SIZE); }
+
+/*
+ * Write want over the chip holding cur, as restore and zero-out do: read,
+ * write the pages that differ, read them back (wplanVerify without its
+ * messages).
+ */
+static double writePlan(const BYTE* cur, const BYTE* want) {
+	WritePlan plan;
+	double t;
+	BYTE* mem;
+	int i, ok;
+	loadChip(cur, 512);
+	t = nowNs();
+	ok = i2c_read_bytes(&bus, 0, buf, 512) == 512;
+	wplanBuild(&plan, buf, want, 512, I2C_PAGE_SIZE);
+	ok = ok && wplanExecute(&bus, &plan, (BYTE*)want);
+	for (i = 0; ok && i < plan.count; i++) {
+		const WriteRange* r = &plan.range[i];
+		ok = i2c_read_bytes(&bus, r->addr, buf, r->n) == r->n && !memcmp(buf, want + r->addr, r->n);
+	}
+	t = nowNs() - t;
+	if (!ok)
+		fprintf(stderr, "write failed\n");
+	if (simImage(PORT, &mem) != 512 || memcmp(mem, want, 512))
+		fprintf(stderr, "chip contents differ after the write\n");
+	return t / 1e6;
+}
+
+static double benchRestore() {
+	BYTE erased[512];
+	memset(erased, 0xff, sizeof(erased));
+	return writePlan(erased, clean_K);
+}
+
+static double benchZero() {
+	static const int offsets[] = {0x58, 0x68, 0x78, 0x88, 0x90, 0xA0};
+	BYTE used[512];
+	int i;
+	memcpy(used, clean_K, 512);
+	for (i = 0; i < 6; i++)
+		used[offsets[i] + 3] = 0x42; // some pages printed
+	return writePlan(used, clean_K);
+}
+
+static Bench benches[] = {
+	{ "port_out",        "ns",    0,   5, benchOut },
+	{ "port_in",         "ns",    0,   5, benchIn },
+	{ "wait_short_p50",  "ns",    0, 100, benchShort },
+	{ "wait_short_p99",  "ns",    0, 200, benchShort99 },
+	{ "wait_norm_p50",   "ns",    0, 100, benchNorm },
+	{ "wait_norm_p99",   "ns",    0, 200, benchNorm99 },
+	{ "send_byte",       "bit/s", 1,   0, benchSendByte },
+	{ "recv_byte",       "bit/s", 1,   0, benchRecvByte },
+	{ "read_512",        "ms",    0,   0, benchRead512 },
+	{ "read_2048",       "ms",    0,   0, benchRead2048 },
+	{ "restore",         "ms",    0,   0, benchRestore },
+	{ "zero_out",        "ms",    0,   0, benchZero },
+};
+#define BENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+static Bench* findBench(const char* name) {
+	int i;
+	for (i = 0; i < BENCHES; i++) {
+		if (!strcmp(benches[i].name, name))
+			return &benches[i];
+	}
+	return NULL;
+}
+
+static int loadBaseline(const char* fname) {
+	char line[128], name[64];
+	double value;
+	FILE* f = fopen(fname, "r");
+	Bench* b;
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %lf", name, &value) == 2 && (b = findBench(name)))
+			b->baseline = value;
+	}
+	fclose(f);
+	return 1;
+}
+
+static int saveBaseline(const char* fname) {
+	FILE* f = fopen(fname, "w");
+	int i;
+	if (!f) {
+		fprintf(stderr, "Error writing file '%s'\n", fname);
+		return 0;
+	}
+	fprintf(f, "# ssebr2 benchmark baseline: name, median result, unit\n");
+	for (i = 0; i < BENCHES; i++)
+		fprintf(f, "%s %.6g %s\n", benches[i].name, benches[i].value, benches[i].unit);
+	return !fclose(f);
+}
+
+int main(int argc, char** argv) {
+	const char* fname = BASELINE;
+	int i, j, c, save = 0, tolerance = TOLERANCE, regressions = 0;
+	double runs[RUNS];
+
+	while ((c = getopt(argc, argv, "sb:t:")) > 0) {
+		switch (c) {
+		case 's':
+			save = 1;
+			break;
+		case 'b':
+			fname = optarg;
+			break;
+		case 't':
+			tolerance = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-s] [-b <baseline file>] [-t <tolerance %%>]\n\n"
+					" -s  store the results as the baseline\n"
+					" -b  baseline file (default %s)\n"
+					" -t  slowdown in percent that counts as a regression (default %d)\n",
+					argv[0], BASELINE, TOLERANCE);
+			return 2;
+		}
+	}
+	if (!timerInit(1000000L) || !timerStart() || !portOpen(PORT_SIM))
+		return 2;
+	i2c_init(&bus);
+	loadChip(clean_K, 512);
+	i2c_setBasePort(&bus, PORT);
+	if (!save && !loadBaseline(fname))
+		printf("No baseline in '%s', run with -s to store one\n", fname);
+
+	printf("%-16s %12s %12s %8s\n", "benchmark", "result", "baseline", "change");
+	for (i = 0; i < BENCHES; i++) {
+		Bench* b = &benches[i];
+		double change;
+		for (j = 0; j < RUNS; j++)
+			runs[j] = b->run();
+		qsort(runs, RUNS, sizeof(runs[0]), cmpDouble);
+		b->value = runs[RUNS / 2];
+		printf("%-16s %12.6g", b->name, b->value);
+		if (b->baseline <= 0) {
+			printf(" %12s %8s %s\n", "-", "", b->unit);
+			continue;
+		}
+		change = (b->value - b->baseline) / b->baseline * 100;
+		printf(" %12.6g %+7.1f%% %s", b->baseline, change, b->unit);
+		if ((b->higherBetter ? -change : change) > tolerance && fabs(b->value - b->baseline) > b->noise) {
+			printf("  REGRESSION");
+			regressions++;
+		}
+		printf("\n");
+	}
+	i2c_free(&bus);
+	if (save)
+		return !saveBaseline(fname);
+	if (regressions)
+		printf("%d regression%s beyond %d%%\n", regressions, regressions == 1 ? "" : "s", tolerance);
+	return regressions > 0;
+}
@@ -0,0 +1,102 @@
+// calib.c
+//
+// The bit rate is set by the port access latency plus the SHORT/NORM
+// delays, and both vary between ports and cables. Calibration starts from
+// a slow, safe timing, then steps towards shorter clock phases for as long
+// as repeated reads of known fields still match. The chosen setting is one
+// step slower than the fastest one that passed, as margin.
+
+#include <stdio.h>
+#include <string.h>
+#include "i2c_comm.h"
+#include "config.h"
+#include "calib.h"
+#include "msg.h"
+
+#define CALIB_CHECKS 20
+
+/* short/normal phase in timer ticks, slowest first */
+static const int timings[][2] = { {4, 8}, {2, 4}, {2, 3}, {1, 2}, {1, 1}, {0, 1}, {0, 0} };
+#define TIMINGS (sizeof(timings) / sizeof(timings[0]))
+#define DEFAULT_TIMING 3
+
+static const struct {
+	int addr, n;
+} fields[] = { {0x00, 8}, {0x28, 16} }; // signature and serial number
+#define FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+static int readFields(I2CBus* bus, BYTE out[FIELDS][16]) {
+	int i;
+	memset(out, 0, FIELDS * 16);
+	for (i = 0; i < FIELDS; i++) {
+		// no retries, a timing that needs them is too fast
+		if (i2c_probe_read(bus, fields[i].addr, out[i], fields[i].n) != fields[i].n)
+			return 0;
+	}
+	return 1;
+}
+
+static int check(I2CBus* bus, BYTE reference[FIELDS][16], int t) {
+	BYTE tmp[FIELDS][16];
+	int i, j;
+	i2c_set_timing(bus, timings[t][0], timings[t][1]);
+	for (i = 0; i < CALIB_CHECKS; i++) {
+		if (!readFields(bus, tmp))
+			return 0;
+		for (j = 0; j < FIELDS; j++) {
+			if (memcmp(tmp[j], reference[j], fields[j].n))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static void timingKey(char* key, int len, const char* port) {
+	snprintf(key, len, "%s.timing", port);
+}
+
+int calibApply(I2CBus* bus, const char* port) {
+	char key[32];
+	const char* v;
+	int s, n;
+	timingKey(key, sizeof(key), port);
+	v = cfgGet(key);
+	if (!v || sscanf(v, "%d %d", &s, &n) != 2 || s < 0 || n < 0)
+		return 0;
+	i2c_set_timing(bus, s, n);
+	return 1;
+}
+
+int calibRun(I2CBus* bus, const char* port) {
+	BYTE reference[FIELDS][16], tmp[FIELDS][16];
+	char key[32], value[32];
+	int t, fastest = -1;
+
+	// the reference must read identically twice at the slowest timing
+	i2c_set_timing(bus, timings[0][0], timings[0][1]);
+	if (!readFields(bus, reference) || !readFields(bus, tmp) || memcmp(reference, tmp, sizeof(tmp))) {
+		msg("Calibration failed: no stable read even at the slowest timing\n");
+		i2c_set_timing(bus, timings[DEFAULT_TIMING][0], timings[DEFAULT_TIMING][1]);
+		return 0;
+	}
+	for (t = 0; t < TIMINGS; t++) {
+		int ok = check(bus, reference, t);
+		msg("  timing %d/%d: %s\n", timings[t][0], timings[t][1], ok ? "ok" : "failed");
+		if (!ok)
+			break;
+		fastest = t;
+	}
+	if (fastest < 0) {
+		msg("Calibration failed: timing %d/%d is unreliable\n", timings[0][0], timings[0][1]);
+		i2c_set_timing(bus, timings[DEFAULT_TIMING][0], timings[DEFAULT_TIMING][1]);
+		return 0;
+	}
+	if (fastest > 0)
+		fastest--;
+	i2c_set_timing(bus, timings[fastest][0], timings[fastest][1]);
+	msg("Using bus timing %d/%d for %s\n", timings[fastest][0], timings[fastest][1], port);
+	timingKey(key, sizeof(key), port);
+	snprintf(value, sizeof(value), "%d %d", timings[fastest][0], timings[fastest][1]);
+	cfgSet(key, value);
+	return 1;
+}
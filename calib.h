@@ -0,0 +1,23 @@
+// calib.h
+#ifndef CALIB_H_
+#define CALIB_H_
+
+#include "i2c_comm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* apply the timing stored for the port, returns 1 if there was one */
+int calibApply(I2CBus* bus, const char* port);
+/*
+ * Find the fastest bus timing that reliably reads back the signature and
+ * serial number of the selected chip, apply it and store it for the port.
+ */
+int calibRun(I2CBus* bus, const char* port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CALIB_H_ */
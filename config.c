@@ -0,0 +1,84 @@
+// config.c
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "pool.h"
+
+#define CFG_MAX 64
+#define CFG_LEN 64
+
+static char keys[CFG_MAX][CFG_LEN], values[CFG_MAX][CFG_LEN];
+static int count = 0;
+
+static char* trim(char* s) {
+	char* e;
+	while (*s == ' ' || *s == '\t')
+		s++;
+	e = s + strlen(s);
+	while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' || e[-1] == '\n'))
+		*--e = 0;
+	return s;
+}
+
+int cfgLoad(const char* fname) {
+	char line[2 * CFG_LEN + 8];
+	FILE* f = fopen(fname, "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		char* eq = strchr(line, '=');
+		if (line[0] == '#' || !eq)
+			continue;
+		*eq = 0;
+		cfgSet(trim(line), trim(eq + 1));
+	}
+	fclose(f);
+	return 1;
+}
+
+int cfgSave(const char* fname) {
+	int i;
+	FILE* f;
+	poolLock();
+	f = fopen(fname, "w");
+	if (!f) {
+		poolUnlock();
+		printf("Error writing file '%s'\n", fname);
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+		fprintf(f, "%s = %s\n", keys[i], values[i]);
+	fclose(f);
+	poolUnlock();
+	return 1;
+}
+
+const char* cfgGet(const char* key) {
+	const char* v = NULL;
+	int i;
+	poolLock();
+	for (i = 0; i < count && !v; i++) {
+		if (!strcmp(keys[i], key))
+			v = values[i];
+	}
+	poolUnlock();
+	return v;
+}
+
+void cfgSet(const char* key, const char* value) {
+	int i;
+	poolLock();
+	for (i = 0; i < count; i++) {
+		if (!strcmp(keys[i], key))
+			break;
+	}
+	if (i < CFG_MAX) {
+		if (i == count) {
+			snprintf(keys[i], CFG_LEN, "%s", key);
+			count++;
+		}
+		snprintf(values[i], CFG_LEN, "%s", value);
+	}
+	poolUnlock();
+}
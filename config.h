@@ -0,0 +1,21 @@
+// config.h
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CONFIG_FILE "ssebr2.cfg"
+
+/* "key = value" settings persisted between runs */
+int cfgLoad(const char* fname);
+int cfgSave(const char* fname);
+const char* cfgGet(const char* key);
+void cfgSet(const char* key, const char* value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_H_ */
@@ -0,0 +1,96 @@
+// gpio.c
+//
+// Port backend on two GPIO lines through the Linux GPIO v2 character
+// device. Both lines are requested once as open-drain outputs in one line
+// request, so the control register value written by i2c_set turns into a
+// single GPIO_V2_LINE_SET_VALUES_IOCTL that moves SDA and SCL together,
+// and the SDA sample of i2c_get is a GET_VALUES on the same request.
+// Writes that don't change the lines are dropped, as in ppdev.c.
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "gpio.h"
+
+#define LINE_SDA 0 /* bit in the line request */
+#define LINE_SCL 1
+#define CONTROL_SDA 0x04
+#define CONTROL_SCL 0x08 /* inverted, like /SELIN */
+
+static unsigned short gpioBase;
+static int gpioFd = -1;
+static unsigned long long lines; /* levels last set */
+
+int gpioAttach(unsigned short base, const char* spec) {
+	struct gpio_v2_line_request req;
+	char chip[64], path[80];
+	unsigned sda, scl;
+	int fd;
+	if (sscanf(spec, "%63[^:]:%u,%u", chip, &sda, &scl) != 3) {
+		fprintf(stderr, "Invalid GPIO lines '%s', expected <chip>:<sda>,<scl>\n", spec);
+		return 0;
+	}
+	snprintf(path, sizeof(path), strchr(chip, '/') ? "%s" : "/dev/%s", chip);
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		perror(path);
+		return 0;
+	}
+	memset(&req, 0, sizeof(req));
+	req.offsets[LINE_SDA] = sda;
+	req.offsets[LINE_SCL] = scl;
+	req.num_lines = 2;
+	strcpy(req.consumer, "ssebr2");
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_OPEN_DRAIN;
+	req.config.num_attrs = 1;
+	req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	req.config.attrs[0].attr.values = (1 << LINE_SDA) | (1 << LINE_SCL); // bus idle
+	req.config.attrs[0].mask = (1 << LINE_SDA) | (1 << LINE_SCL);
+	if (ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req)) {
+		perror(path);
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	gpioFd = req.fd;
+	gpioBase = base & ~3;
+	lines = req.config.attrs[0].attr.values;
+	return 1;
+}
+
+void gpioDetach(void) {
+	if (gpioFd >= 0)
+		close(gpioFd);
+	gpioFd = -1;
+}
+
+void gpioOutb(unsigned short PortAddress, unsigned char byte) {
+	struct gpio_v2_line_values v;
+	if (gpioFd < 0 || PortAddress != gpioBase + 2)
+		return;
+	v.bits = (byte & CONTROL_SDA ? 1 << LINE_SDA : 0) | (byte & CONTROL_SCL ? 0 : 1 << LINE_SCL);
+	v.mask = (1 << LINE_SDA) | (1 << LINE_SCL);
+	if (v.bits != lines && !ioctl(gpioFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v))
+		lines = v.bits;
+}
+
+unsigned char gpioInb(unsigned short PortAddress) {
+	struct gpio_v2_line_values v;
+	unsigned char b;
+	if (gpioFd < 0 || PortAddress != gpioBase + 2)
+		return 0xff;
+	b = lines & (1 << LINE_SCL) ? 0 : CONTROL_SCL;
+	v.mask = 1 << LINE_SDA;
+	v.bits = 0;
+	if (ioctl(gpioFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) || (v.bits & (1 << LINE_SDA)))
+		b |= CONTROL_SDA;
+	return b;
+}
+
+#endif
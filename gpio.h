@@ -0,0 +1,30 @@
+// gpio.h
+#ifndef GPIO_H_
+#define GPIO_H_
+
+#include "port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Request the SDA and SCL lines described by spec, "<chip>:<sda>,<scl>"
+ * with the chip as a path or a name in /dev (e.g. gpiochip0:17,27), for
+ * the port at base address base. Linux only.
+ */
+int gpioAttach(unsigned short base, const char* spec);
+void gpioDetach(void);
+
+/*
+ * LPT register access, used by the port layer: control bit 2 is SDA and
+ * bit 3 the inverted SCL, as on the LPT wiring
+ */
+void gpioOutb(unsigned short PortAddress, unsigned char byte);
+unsigned char gpioInb(unsigned short PortAddress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPIO_H_ */
@@ -1,9 +1,14 @@
 // i2c_comm.c
 
 #include <stdio.h>
-#include "pt_ioctl.h"
+#include <stdlib.h>
+#include <string.h>
+#include "port.h"
 #include "utimer.h"
 #include "i2c_comm.h"
+#include "vcd.h"
+#include "i2c_dev.h"
+#include "msg.h"
 
 /*******************************************
  * 25 pin D-SUB FEMALE connector at the PC
@@ -38,196 +43,558 @@
         G = Ground = LPT pins 20-25
 
  ***************************************/
-static int basePort = 0x378, controlPort = 0x37A;
 
 // data bit = INIT         control 2 (0x04)
 // clock bit = SELECT(inv) control 3 (0x08)
+// unless another wiring profile is selected, see wirings[]
 
-void i2c_setBasePort(int port) {
-	basePort = port;
-	controlPort = basePort + 2;
-	outp(basePort, 0xff);
-	outp(basePort+1, 0xff);
-	outp(basePort+2, 0xff);
-}
-static int i2c_get() {
-	return (inp(controlPort) >> 2) & 1;
-}
-static void i2c_set(BYTE clk, BYTE data) {
-	outp(controlPort, (data<<2) | ((clk^1)<<3));
-}
 #define SHORT 1
 #define NORM 2
 #define I2C_WRITE 0x80
 #define I2C_READ 0x81
-static int chipID = 0;
 
-void i2c_start() {
+#ifdef __GNUC__
+#define KERNEL static inline __attribute__((always_inline))
+#else
+#define KERNEL static __inline
+#endif
+
+void i2c_init(I2CBus* bus) {
+	memset(bus, 0, sizeof(*bus));
+	bus->basePort = 0x378;
+	bus->controlPort = 0x37A;
+	bus->tShort = SHORT;
+	bus->tNorm = NORM;
+	waveInit(&bus->wave, bus);
+	i2c_set_wiring(bus, i2c_wiring(0));
+	bus->devFd = -1;
+	i2c_stats_reset(bus);
+}
+void i2c_free(I2CBus* bus) {
+	waveFree(&bus->wave);
+	free(bus->samples);
+	bus->samples = NULL;
+	bus->samplesSize = 0;
+}
+void i2c_setBasePort(I2CBus* bus, int port) {
+	bus->basePort = port;
+	bus->controlPort = bus->basePort + 2;
+	i2c_set_wiring(bus, bus->wiring);
+	outp(bus->basePort, 0xff);
+	outp(bus->basePort+1, 0xff);
+	// bit 5 of the control register turns the data pins of PS/2 and ECP ports into inputs
+	outp(bus->basePort+2, bus->wiring->outReg ? 0xff : I2C_CONTROL_FORWARD);
+}
+KERNEL int sample(I2CBus* bus, const int inReg, const int inBit, const int inInv) {
+	int bit = ((inp(bus->basePort + inReg) >> inBit) & 1) ^ inInv;
+	bus->stats.portReads++;
+	if (bus->capture)
+		vcdIn(bus->capture, bit);
+	return bit;
+}
+static int i2c_get(I2CBus* bus) {
+	const I2CWiring* w = bus->wiring;
+	return sample(bus, w->inReg, w->inBit, w->inInv);
+}
+BYTE i2c_encode(I2CBus* bus, int clk, int data) {
+	return bus->code[clk << 1 | data];
+}
+static void i2c_set(I2CBus* bus, BYTE clk, BYTE data) {
+	bus->stats.portWrites++;
+	outp(bus->outPort, bus->code[clk << 1 | data]);
+	if (bus->capture)
+		vcdOut(bus->capture, clk, data);
+}
+/* record the line levels an output register value sets */
+static void captureOut(I2CBus* bus, BYTE out) {
+	const I2CWiring* w = bus->wiring;
+	vcdOut(bus->capture, ((out >> w->sclBit) & 1) ^ w->sclInv, ((out >> w->sdaBit) & 1) ^ w->sdaInv);
+}
+
+/*
+ * Replay a compiled transaction. A failed WAVE_IDLE check replays the step
+ * before it and itself, like the retry loop in i2c_start; after 10 tries it
+ * clears the bus and tries 10 more times. Returns -1 if SDA stays stuck.
+ *
+ * The loop is instantiated for each wiring with its registers and SDA
+ * bit as constants, so an edge is a write and a wait and a sample a read
+ * and a shift, whatever the wiring.
+ */
+KERNEL int play(I2CBus* bus, const Wave* w, BYTE* samples, const int outReg,
+		const int inReg, const int inBit, const int inInv) {
+	const WaveStep* s;
+	const unsigned short out = bus->basePort + outReg;
+	int i, n = 0, tries = 10, cleared = 0, rc = -1;
+	long long start = timerNanos(), spin = timerSpinNanos();
+	bus->stats.portWrites += w->count;
+	bus->stats.bitsSent += w->bits;
+	for (i = 0; i < w->count; i++) {
+		s = w->step + i;
+		outp(out, s->out);
+		if (bus->capture)
+			captureOut(bus, s->out);
+		timerWait(s->ticks);
+		if (s->flags & WAVE_SAMPLE) {
+			BYTE bit = sample(bus, inReg, inBit, inInv);
+			if (!bit && (s->flags & WAVE_IDLE)) {
+				if (!--tries && !cleared && i2c_bus_clear(bus)) {
+					cleared = 1; // once per START
+					tries = 10;
+				}
+				if (tries) {
+					bus->stats.startRetries++;
+					bus->stats.portWrites += 2;
+					i -= 2;
+					continue;
+				}
+				msg("i2c_start failed, SDA is stuck low\n");
+				goto ex;
+			}
+			if (s->flags & WAVE_IDLE)
+				cleared = 0;
+			tries = 10;
+			if (!(s->flags & WAVE_IDLE))
+				bus->stats.bitsRead++;
+			samples[n++] = bit;
+		}
+	}
+	rc = n;
+ex:
+	bus->stats.waveNanos += timerNanos() - start;
+	bus->stats.waveSpinNanos += timerSpinNanos() - spin;
+	return rc;
+}
+
+/*
+ * The wiring profiles: name, pins, output register, SDA bit and inversion,
+ * SCL bit and inversion, input register, SDA bit and inversion. Each one
+ * gets its own play function with these as constants.
+ */
+#define WIRINGS(X) \
+	X(Lpt, "lpt", "SDA pin 16 (/INIT), SCL pin 17 (/SELIN), SDA read back on pin 16", \
+			2, 2, 0, 3, 1, 2, 2, 0) \
+	X(LptAck, "lpt-ack", "SDA pin 16 (/INIT), SCL pin 17 (/SELIN), SDA read back on pin 10 (/ACK)", \
+			2, 2, 0, 3, 1, 1, 6, 0) \
+	X(LptBusy, "lpt-busy", "SDA pin 16 (/INIT), SCL pin 17 (/SELIN), SDA read back on pin 11 (BUSY)", \
+			2, 2, 0, 3, 1, 1, 7, 1) \
+	X(Data, "data", "SDA pin 2 (D0), SCL pin 3 (D1) through open-collector drivers, SDA read back on pin 10 (/ACK)", \
+			0, 0, 0, 1, 0, 1, 6, 0)
+
+#define PLAY_FUNCTION(id, name, pins, outReg, sdaBit, sdaInv, sclBit, sclInv, inReg, inBit, inInv) \
+	static int play##id(I2CBus* bus, const Wave* w, BYTE* samples) { \
+		return play(bus, w, samples, outReg, inReg, inBit, inInv); \
+	}
+#define WIRING_ENTRY(id, name, pins, outReg, sdaBit, sdaInv, sclBit, sclInv, inReg, inBit, inInv) \
+	{ name, pins, outReg, sdaBit, sdaInv, sclBit, sclInv, inReg, inBit, inInv, play##id },
+
+WIRINGS(PLAY_FUNCTION)
+
+static const I2CWiring wirings[] = {
+	WIRINGS(WIRING_ENTRY)
+};
+
+const I2CWiring* i2c_wiring(int i) {
+	return i >= 0 && i < (int)(sizeof(wirings) / sizeof(wirings[0])) ? &wirings[i] : NULL;
+}
+const I2CWiring* i2c_find_wiring(const char* name) {
+	const I2CWiring* w;
+	int i;
+	for (i = 0; (w = i2c_wiring(i)) && strcmp(w->name, name); i++)
+		;
+	return w;
+}
+void i2c_set_wiring(I2CBus* bus, const I2CWiring* w) {
+	int clk, data;
+	bus->wiring = w;
+	for (clk = 0; clk < 2; clk++) {
+		for (data = 0; data < 2; data++)
+			bus->code[clk << 1 | data] = (BYTE)((data ^ w->sdaInv) << w->sdaBit | (clk ^ w->sclInv) << w->sclBit);
+	}
+	bus->outPort = bus->basePort + w->outReg;
+	bus->inPort = bus->basePort + w->inReg;
+}
+int i2c_play(I2CBus* bus, const Wave* w, BYTE* samples) {
+	return bus->wiring->play(bus, w, samples);
+}
+
+void i2c_start(I2CBus* bus) {
 	int i;
 	for (i = 10; i; i--) {
-		i2c_set(0, 1);
-		timerWait(SHORT);
-		i2c_set(1, 1);
-		timerWait(NORM);
-		if (i2c_get())
+		i2c_set(bus, 0, 1);
+		timerWait(bus->tShort);
+		i2c_set(bus, 1, 1);
+		timerWait(bus->tNorm);
+		if (i2c_get(bus))
 			break;
+		bus->stats.startRetries++;
 	}
-	if (!i)
-		printf("i2c_start failed\n");
-	i2c_set(1, 0);
-	timerWait(NORM);
-	i2c_set(0, 0);
-	timerWait(SHORT);
-}
-void i2c_stop() {
-	i2c_set(0, 0);
-	timerWait(SHORT);
-	i2c_set(1, 0);
-	timerWait(NORM);
-	i2c_set(1, 1);
-	timerWait(NORM);
-}
-int i2c_recv_bit() {
-	i2c_set(0, 1);
-	timerWait(SHORT);
-	i2c_set(1, 1);
-	timerWait(NORM);
-	int bit = i2c_get();
-	i2c_set(0, 1);
-	timerWait(SHORT);
+	if (!i && !i2c_bus_clear(bus))
+		msg("i2c_start failed\n");
+	i2c_set(bus, 1, 0);
+	timerWait(bus->tNorm);
+	i2c_set(bus, 0, 0);
+	timerWait(bus->tShort);
+}
+void i2c_stop(I2CBus* bus) {
+	i2c_set(bus, 0, 0);
+	timerWait(bus->tShort);
+	i2c_set(bus, 1, 0);
+	timerWait(bus->tNorm);
+	i2c_set(bus, 1, 1);
+	timerWait(bus->tNorm);
+}
+/*
+ * Bus clear: a chip interrupted while sending a 0 bit keeps SDA low until
+ * it has clocked out the rest of its byte. Clock SCL with SDA released,
+ * at most 9 times, until it lets go, then send a STOP.
+ */
+int i2c_bus_clear(I2CBus* bus) {
+	int i;
+	if (bus->devFd >= 0)
+		return 1; // the adapter's business
+	bus->stats.busClears++;
+	i2c_set(bus, 0, 1);
+	timerWait(bus->tShort);
+	for (i = 0; i < 9 && !i2c_get(bus); i++) {
+		i2c_set(bus, 1, 1);
+		timerWait(bus->tNorm);
+		i2c_set(bus, 0, 1);
+		timerWait(bus->tShort);
+	}
+	i2c_stop(bus);
+	return i2c_get(bus);
+}
+int i2c_recv_bit(I2CBus* bus) {
+	bus->stats.bitsRead++;
+	i2c_set(bus, 0, 1);
+	timerWait(bus->tShort);
+	i2c_set(bus, 1, 1);
+	timerWait(bus->tNorm);
+	int bit = i2c_get(bus);
+	i2c_set(bus, 0, 1);
+	timerWait(bus->tShort);
 	return bit;
 }
-void i2c_send_bit(int bit) {
+void i2c_send_bit(I2CBus* bus, int bit) {
 	bit &= 1;
-	i2c_set(0, bit);
-	timerWait(SHORT);
-	i2c_set(1, bit);
-	timerWait(NORM);
-	i2c_set(0, bit);
-	timerWait(SHORT);
+	bus->stats.bitsSent++;
+	i2c_set(bus, 0, bit);
+	timerWait(bus->tShort);
+	i2c_set(bus, 1, bit);
+	timerWait(bus->tNorm);
+	i2c_set(bus, 0, bit);
+	timerWait(bus->tShort);
 }
 /* ack: 1 = ok, 0 = no */
-int i2c_recv_ack() {
-	return !i2c_recv_bit();
+int i2c_recv_ack(I2CBus* bus) {
+	if (i2c_recv_bit(bus)) {
+		bus->stats.nacks++;
+		return 0;
+	}
+	return 1;
 }
-int i2c_send_byte(int b) {
+int i2c_send_byte(I2CBus* bus, int b) {
 	int i;
 	for (i = 7; i >= 0; i--) {
-		i2c_send_bit(b >> i);
+		i2c_send_bit(bus, b >> i);
 	}
-	return i2c_recv_ack();
+	return i2c_recv_ack(bus);
 }
-int i2c_recv_byte(int ack) {
+int i2c_recv_byte(I2CBus* bus, int ack) {
 	int i, b = 0;
 	for (i = 0; i < 8; i++) {
-		b = (b << 1) | i2c_recv_bit();
+		b = (b << 1) | i2c_recv_bit(bus);
 	}
-	if (ack && !i2c_recv_ack())
+	if (ack && !i2c_recv_ack(bus))
 		return -1;
 	return b;
 }
-int i2c_write_byte(int addr, int b) {
-	i2c_start();
-	if (!i2c_send_byte(I2C_WRITE | chipID | ((addr >> 7) & 0x0e))) {
-		printf("i2c_write_byte step 1 failed\n");
+int i2c_write_byte(I2CBus* bus, int addr, int b) {
+	i2c_start(bus);
+	if (!i2c_send_byte(bus, I2C_WRITE | bus->chipID | ((addr >> 7) & 0x0e))) {
+		msg("i2c_write_byte step 1 failed\n");
 		return 0;
 	}
-	if (!i2c_send_byte(addr & 0xff)) {
-		printf("i2c_write_byte step 2 failed\n");
+	if (!i2c_send_byte(bus, addr & 0xff)) {
+		msg("i2c_write_byte step 2 failed\n");
 		return 0;
 	}
-	int rc = i2c_send_byte(b);
-	i2c_stop();
-	rc &= i2c_wait_init(1);
+	int rc = i2c_send_byte(bus, b);
+	i2c_stop(bus);
+	rc &= i2c_wait_write(bus);
 	return rc;
 }
-int i2c_read_addr() {
-	i2c_start();
-	if (i2c_send_byte(I2C_READ | chipID)) {
-		printf("i2c_read_addr step 1 failed\n");
+int i2c_read_addr(I2CBus* bus) {
+	i2c_start(bus);
+	if (i2c_send_byte(bus, I2C_READ | bus->chipID)) {
+		msg("i2c_read_addr step 1 failed\n");
 		return -1;
 	}
-	int rc = i2c_recv_byte(0);
-	i2c_stop();
+	int rc = i2c_recv_byte(bus, 0);
+	i2c_stop(bus);
 	return rc;
 }
-int i2c_read_byte(int addr) {
-	i2c_start();
-	if (!i2c_send_byte(I2C_WRITE | chipID | ((addr >> 7) & 0x0e))) {
-		printf("i2c_read_byte step 1 failed\n");
+int i2c_read_byte(I2CBus* bus, int addr) {
+	i2c_start(bus);
+	if (!i2c_send_byte(bus, I2C_WRITE | bus->chipID | ((addr >> 7) & 0x0e))) {
+		msg("i2c_read_byte step 1 failed\n");
 		return -1;
 	}
-	if (!i2c_send_byte(addr & 0xff)) {
-		printf("i2c_read_byte step 2 failed\n");
+	if (!i2c_send_byte(bus, addr & 0xff)) {
+		msg("i2c_read_byte step 2 failed\n");
 		return -1;
 	}
-	i2c_start();
-	i2c_send_byte(I2C_READ | chipID | ((addr >> 7) & 0x0e));
-	int rc = i2c_recv_byte(0);
-	i2c_stop();
+	i2c_start(bus);
+	i2c_send_byte(bus, I2C_READ | bus->chipID | ((addr >> 7) & 0x0e));
+	int rc = i2c_recv_byte(bus, 0);
+	i2c_stop(bus);
 	return rc;
 }
-void i2c_select_chip(int id) {
-	chipID = id;
+void i2c_set_timing(I2CBus* bus, int shortTicks, int normTicks) {
+	bus->tShort = shortTicks;
+	bus->tNorm = normTicks;
+}
+void i2c_select_chip(I2CBus* bus, int id) {
+	bus->chipID = id;
+}
+/* address the chip for writing, 1 = acknowledged */
+static int probe(I2CBus* bus) {
+	int rc;
+	if (bus->devFd >= 0)
+		return i2cdevProbe(bus);
+	i2c_start(bus);
+	rc = i2c_send_byte(bus, I2C_WRITE | bus->chipID);
+	i2c_stop(bus);
+	return rc;
 }
-int i2c_wait_init(int retry) {
+int i2c_wait_init(I2CBus* bus, int retry) {
 	int j, rc;
 	for (j = retry ? 5 : 1; j; j--) {
-		i2c_start();
-		rc = i2c_send_byte(I2C_WRITE | chipID);
-		i2c_stop();
+		rc = probe(bus);
+		bus->stats.probes++;
 		if (rc)
 			break;
 		SleepEx(2, 0);
 	}
 	return rc;
 }
-void i2c_charge(DWORD ms) {
-	i2c_set(1, 1);
+/*
+ * Wait for the end of the internal write cycle (tWR) by ACK polling.
+ * The expected cycle time is learned per chip, the first probe is issued
+ * just before it elapses and then the chip is polled back to back until
+ * it acknowledges or the deadline passes.
+ */
+#define WRITE_CYCLE_MAX 20000 /* us */
+
+int i2c_wait_write(I2CBus* bus) {
+	long* est = &bus->writeCycle[(bus->chipID >> 2) & 31];
+	long long start = timerMicros(), elapsed;
+	int rc, probes = 0, phase = i2c_phase(bus, I2C_PHASE_ACKPOLL);
+	while (timerMicros() - start < *est - *est / 8)
+		;
+	do {
+		rc = probe(bus);
+		probes++;
+		elapsed = timerMicros() - start;
+	} while (!rc && elapsed < WRITE_CYCLE_MAX);
+	bus->stats.ackPolls += probes;
+	i2c_phase(bus, phase);
+	if (rc) {
+		if (!*est)
+			*est = (long)elapsed;
+		else if (probes == 1)
+			*est -= *est / 8; // already done, try earlier next time
+		else
+			*est = (*est * 3 + (long)elapsed) / 4;
+	}
+	return rc;
+}
+void i2c_charge(I2CBus* bus, DWORD ms) {
+	i2c_set(bus, 1, 1);
 	SleepEx(ms, 0);
 }
-int i2c_read_bytes(int addr, BYTE* b, int n) {
-	i2c_start();
-	int i, rc;
-	if (!i2c_send_byte(I2C_WRITE | chipID | ((addr >> 7) & 0x0e))) {
-		printf("i2c_read_bytes step 1 failed\n");
-		return 0;
+static BYTE* playWave(I2CBus* bus) {
+	if (bus->samplesSize < bus->wave.samples) {
+		BYTE* p = realloc(bus->samples, bus->wave.samples);
+		if (!p)
+			return NULL;
+		bus->samples = p;
+		bus->samplesSize = bus->wave.samples;
 	}
-	if (!i2c_send_byte(addr & 0xff)) {
-		printf("i2c_read_bytes step 2 failed\n");
-		return 0;
-	}
-	i2c_start();
-	i2c_send_byte(I2C_READ | chipID | ((addr >> 7) & 0x0e));
+	return i2c_play(bus, &bus->wave, bus->samples) < 0 ? NULL : bus->samples;
+}
+
+/* one sequential read, returns n or -1 if the chip didn't acknowledge */
+static int readBytes(I2CBus* bus, int addr, BYTE* b, int n) {
+	int i, dev, word, data;
+	BYTE* r;
+	if (bus->devFd >= 0)
+		return i2cdevRead(bus, addr, b, n);
+	waveClear(&bus->wave);
+	waveStart(&bus->wave);
+	dev = waveSendByte(&bus->wave, I2C_WRITE | bus->chipID | ((addr >> 7) & 0x0e));
+	word = waveSendByte(&bus->wave, addr & 0xff);
+	waveStart(&bus->wave);
+	waveSendByte(&bus->wave, I2C_READ | bus->chipID | ((addr >> 7) & 0x0e));
+	data = bus->wave.samples;
 	for (i = 0; i < n; i++) {
 		if (i)
-			i2c_send_bit(0);
-		rc = i2c_recv_byte(0);
-		if (rc < 0)
+			waveSendBit(&bus->wave, 0);
+		waveRecvByte(&bus->wave, 0);
+	}
+	waveStop(&bus->wave);
+	if (!(r = playWave(bus)))
+		return -1;
+	if (r[dev] || r[word]) {
+		bus->stats.nacks++;
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		b[i] = (BYTE)waveByte(r, data + i * 8);
+	return n;
+}
+/*
+ * Read n bytes in one transaction, rolling over the blocks. A chip that
+ * browns out or loses track doesn't acknowledge the next transaction, so
+ * a read only counts once the chip has answered after it. On a failure
+ * the bus is cleared, the chip given a moment to recharge and the read
+ * resumed in chunks of I2C_READ_CHUNK bytes, each confirmed by the next,
+ * so a chip that keeps failing loses at most two chunks per retry.
+ * Returns the number of bytes read.
+ */
+int i2c_read_bytes(I2CBus* bus, int addr, BYTE* b, int n) {
+	int done = 0, pending = 0, retry = I2C_READ_RETRY, chunk = n;
+	while (done < n) {
+		if (chunk > n - done)
+			chunk = n - done;
+		if (readBytes(bus, addr + done, b + done, chunk) == chunk) {
+			// the next chunk's address confirms this one, the last needs a probe
+			if (done + chunk < n || n <= I2C_READ_CHUNK || i2c_wait_init(bus, 0)) {
+				done += chunk;
+				pending = 1;
+				continue;
+			}
+		} else if (pending) {
+			done -= I2C_READ_CHUNK; // the chunk before may be garbage too
+		}
+		pending = 0;
+		if (!retry--)
 			break;
-		else
-			b[i] = (BYTE)rc;
+		msg("Read failed at offset %d, clearing the bus and resuming\n", addr + done);
+		bus->stats.readRetries++;
+		i2c_bus_clear(bus);
+		i2c_charge(bus, 2);
+		chunk = I2C_READ_CHUNK;
 	}
-	i2c_stop();
-	return i;
+	return done;
 }
-int i2c_write_page(int addr, BYTE* b, int n) {
-	i2c_start();
-	int i, rc = 0;
-	if (!i2c_send_byte(I2C_WRITE | chipID | ((addr >> 7) & 0x0e))) {
-		printf("i2c_write_page step 1 failed\n");
+int i2c_probe_read(I2CBus* bus, int addr, BYTE* b, int n) {
+	return readBytes(bus, addr, b, n);
+}
+int i2c_write_page(I2CBus* bus, int addr, BYTE* b, int n) {
+	int i, dev, word, data;
+	BYTE* r;
+	if (bus->devFd >= 0) {
+		if (!i2cdevWrite(bus, addr, b, n)) {
+			bus->stats.nacks++;
+			return 0;
+		}
+		return i2c_wait_write(bus);
+	}
+	waveClear(&bus->wave);
+	waveStart(&bus->wave);
+	dev = waveSendByte(&bus->wave, I2C_WRITE | bus->chipID | ((addr >> 7) & 0x0e));
+	word = waveSendByte(&bus->wave, addr & 0xff);
+	data = bus->wave.samples;
+	for (i = 0; i < n; i++)
+		waveSendByte(&bus->wave, b[i]);
+	waveStop(&bus->wave);
+	if (!(r = playWave(bus)))
+		return 0;
+	if (r[dev] || r[word])
+		bus->stats.nacks++;
+	if (r[dev]) {
+		msg("i2c_write_page step 1 failed\n");
 		return 0;
 	}
-	if (!i2c_send_byte(addr & 0xff)) {
-		printf("i2c_write_page step 2 failed\n");
+	if (r[word]) {
+		msg("i2c_write_page step 2 failed\n");
 		return 0;
 	}
 	for (i = 0; i < n; i++) {
-		rc = i2c_send_byte(b[i]);
-		if (!rc)
-			break;
+		if (r[data + i]) {
+			// the wave clocked the rest of the page in anyway, the chip may be writing it
+			bus->stats.nacks++;
+			i2c_wait_write(bus);
+			return 0;
+		}
 	}
-	i2c_stop();
-	rc &= i2c_wait_init(1);
-	return rc;
+	return i2c_wait_write(bus);
+}
+
+int i2c_phase(I2CBus* bus, int phase) {
+	I2CStats* st = &bus->stats;
+	long long now = timerNanos();
+	int prev = st->phase;
+	st->phaseNanos[prev] += now - st->phaseStart;
+	st->phaseStart = now;
+	st->phase = phase;
+	return prev;
+}
+void i2c_stats_reset(I2CBus* bus) {
+	I2CStats* st = &bus->stats;
+	int phase = st->phase;
+	memset(st, 0, sizeof(*st));
+	st->phase = phase;
+	st->phaseStart = timerNanos();
+	st->spinStart = timerSpinNanos();
+}
+static int statsJson(const I2CStats* st, long long spin, char* out, int len) {
+	static const char* names[I2C_PHASES] = { "other", "charge", "detect", "read", "write", "ackpoll", "verify" };
+	long long total = 0;
+	int i, n;
+	n = snprintf(out, len, "{\"phases_us\":{");
+	for (i = 0; i < I2C_PHASES; i++) {
+		total += st->phaseNanos[i];
+		n += snprintf(out + n, n < len ? len - n : 0, "%s\"%s\":%lld", i ? "," : "", names[i], st->phaseNanos[i] / 1000);
+	}
+	n += snprintf(out + n, n < len ? len - n : 0,
+			"},\"total_us\":%lld,\"spin_us\":%lld,\"wave_us\":%lld,\"wave_io_us\":%lld,"
+			"\"port_writes\":%ld,\"port_reads\":%ld,\"bits_sent\":%ld,\"bits_read\":%ld,"
+			"\"nacks\":%ld,\"start_retries\":%ld,\"bus_clears\":%ld,\"read_retries\":%ld,"
+			"\"probes\":%ld,\"ack_polls\":%ld,\"dev_messages\":%ld,\"dev_bytes\":%ld}",
+			total / 1000, spin / 1000, st->waveNanos / 1000,
+			(st->waveNanos - st->waveSpinNanos) / 1000,
+			st->portWrites, st->portReads, st->bitsSent, st->bitsRead,
+			st->nacks, st->startRetries, st->busClears, st->readRetries,
+			st->probes, st->ackPolls, st->devMessages, st->devBytes);
+	return n;
+}
+int i2c_stats_json(I2CBus* bus, char* out, int len) {
+	i2c_phase(bus, bus->stats.phase);
+	return statsJson(&bus->stats, timerSpinNanos() - bus->stats.spinStart, out, len);
+}
+void i2c_stats_add(I2CStats* total, I2CBus* bus) {
+	const I2CStats* st = &bus->stats;
+	int i;
+	total->portWrites += st->portWrites;
+	total->portReads += st->portReads;
+	total->bitsSent += st->bitsSent;
+	total->bitsRead += st->bitsRead;
+	total->nacks += st->nacks;
+	total->startRetries += st->startRetries;
+	total->busClears += st->busClears;
+	total->readRetries += st->readRetries;
+	total->probes += st->probes;
+	total->ackPolls += st->ackPolls;
+	total->devMessages += st->devMessages;
+	total->devBytes += st->devBytes;
+	total->waveNanos += st->waveNanos;
+	total->waveSpinNanos += st->waveSpinNanos;
+	for (i = 0; i < I2C_PHASES; i++)
+		total->phaseNanos[i] += st->phaseNanos[i];
+	total->spinNanos += timerSpinNanos() - st->spinStart;
+}
+int i2c_stats_total_json(const I2CStats* total, char* out, int len) {
+	return statsJson(total, total->spinNanos, out, len);
 }
@@ -1,28 +1,134 @@
 // i2c_comm.h
-#include "pt_ioctl.h"
+#ifndef I2C_COMM_H_
+#define I2C_COMM_H_
+
+#include "port.h"
 #include "utimer.h"
+#include "i2c_wave.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void i2c_setBasePort(int port);
-void i2c_select_chip(int id);
-void i2c_start();
-void i2c_stop();
-int i2c_recv_bit();
-void i2c_send_bit(int bit);
+#define I2C_PAGE_SIZE 16 /* 24C16 page write buffer */
+#define I2C_READ_CHUNK 128 /* bytes per read transaction after a failure, the unit of resuming */
+#define I2C_READ_RETRY 8   /* bus clears per i2c_read_bytes, and per lane in lanesRead */
+#define I2C_CONTROL_FORWARD 0xdf /* control register value that keeps the data pins outputs */
+
+/* where the bus time goes, see i2c_phase */
+enum {
+	I2C_PHASE_OTHER,
+	I2C_PHASE_CHARGE,
+	I2C_PHASE_DETECT,
+	I2C_PHASE_READ,
+	I2C_PHASE_WRITE,
+	I2C_PHASE_ACKPOLL,
+	I2C_PHASE_VERIFY,
+	I2C_PHASES
+};
+
+/* counters since the last i2c_stats_reset */
+typedef struct {
+	long portWrites, portReads;
+	long bitsSent, bitsRead;  /* bits read include ACK slots */
+	long nacks;               /* address or data bytes not acknowledged */
+	long startRetries;        /* idle checks repeated before a START */
+	long busClears, readRetries;
+	long probes;              /* i2c_wait_init */
+	long ackPolls;            /* i2c_wait_write */
+	long devMessages, devBytes; /* kernel adapter transfers and their bytes */
+	long long waveNanos;      /* time in i2c_play */
+	long long waveSpinNanos;  /* of which waiting in timerWait */
+	long long phaseNanos[I2C_PHASES];
+	long long spinNanos;      /* timerWait spinning, in totals of i2c_stats_add */
+	long long spinStart, phaseStart;
+	int phase;
+} I2CStats;
+
+struct VcdCapture;
+struct I2CBus;
+
+/*
+ * Where SDA and SCL are wired on the LPT port: the register (offset from
+ * the base address) and bit of each line, and whether the port inverts
+ * it. SDA and SCL share one output register, so an edge is one write.
+ */
+typedef struct {
+	const char* name;
+	const char* pins;
+	int outReg;
+	int sdaBit, sdaInv;
+	int sclBit, sclInv;
+	int inReg, inBit, inInv; /* SDA read back */
+	/* i2c_play compiled for these constants */
+	int (*play)(struct I2CBus* bus, const Wave* w, BYTE* samples);
+} I2CWiring;
+
+/* state of the bus on one port, each port is driven by its own thread */
+typedef struct I2CBus {
+	int basePort, controlPort;
+	const I2CWiring* wiring;
+	int outPort, inPort;
+	BYTE code[4];          /* output register value for clk << 1 | data */
+	int chipID;
+	int tShort, tNorm;     /* clock phases in timer ticks */
+	long writeCycle[32];   /* learned write-cycle time per chip ID, us */
+	Wave wave;
+	BYTE* samples;
+	int samplesSize;
+	I2CStats stats;
+	struct VcdCapture* capture; /* line events are recorded here if set */
+	int devFd;                  /* kernel I2C adapter, -1 when bit banging */
+	unsigned long devFuncs;
+	int devSlave;
+} I2CBus;
+
+void i2c_init(I2CBus* bus);
+void i2c_free(I2CBus* bus);
+void i2c_setBasePort(I2CBus* bus, int port);
+void i2c_select_chip(I2CBus* bus, int id);
+/* clock phase lengths in timer ticks, default 1 (short) and 2 (normal) */
+void i2c_set_timing(I2CBus* bus, int shortTicks, int normTicks);
+void i2c_start(I2CBus* bus);
+void i2c_stop(I2CBus* bus);
+/* free a chip holding SDA low, returns 1 if SDA is high */
+int i2c_bus_clear(I2CBus* bus);
+int i2c_recv_bit(I2CBus* bus);
+void i2c_send_bit(I2CBus* bus, int bit);
 /* ack: 1 = ok, 0 = no */
-int i2c_recv_ack();
-int i2c_send_byte(int b);
-int i2c_recv_byte(int ack);
-int i2c_write_byte(int addr, int b);
-int i2c_read_byte(int addr);
-int i2c_wait_init(int retry);
-void i2c_charge(DWORD ms);
-int i2c_read_bytes(int addr, BYTE* b, int n);
-int i2c_write_page(int addr, BYTE* b, int n);
+int i2c_recv_ack(I2CBus* bus);
+int i2c_send_byte(I2CBus* bus, int b);
+int i2c_recv_byte(I2CBus* bus, int ack);
+int i2c_write_byte(I2CBus* bus, int addr, int b);
+int i2c_read_byte(I2CBus* bus, int addr);
+int i2c_wait_init(I2CBus* bus, int retry);
+/* poll for the end of a write cycle, 1 = done */
+int i2c_wait_write(I2CBus* bus);
+void i2c_charge(I2CBus* bus, DWORD ms);
+/* resumes after errors, returns the number of bytes read */
+int i2c_read_bytes(I2CBus* bus, int addr, BYTE* b, int n);
+/* one transaction, returns -1 quietly if the chip doesn't answer */
+int i2c_probe_read(I2CBus* bus, int addr, BYTE* b, int n);
+int i2c_write_page(I2CBus* bus, int addr, BYTE* b, int n);
+/* charge the time from now on to phase, returns the previous phase */
+int i2c_phase(I2CBus* bus, int phase);
+void i2c_stats_reset(I2CBus* bus);
+/* the counters as a JSON object, returns its length */
+int i2c_stats_json(I2CBus* bus, char* out, int len);
+/* add the counters of a bus as of i2c_stats_json to a total, and the total as a JSON object */
+void i2c_stats_add(I2CStats* total, I2CBus* bus);
+int i2c_stats_total_json(const I2CStats* total, char* out, int len);
+/* the wiring profiles, NULL past the last; the first is the default */
+const I2CWiring* i2c_wiring(int i);
+const I2CWiring* i2c_find_wiring(const char* name);
+void i2c_set_wiring(I2CBus* bus, const I2CWiring* wiring);
+/* output register value for the given line levels */
+BYTE i2c_encode(I2CBus* bus, int clk, int data);
+/* replay a compiled transaction, returns the number of samples or -1 */
+int i2c_play(I2CBus* bus, const Wave* w, BYTE* samples);
 
 #ifdef __cplusplus
 }
 #endif
+
+#endif /* I2C_COMM_H_ */
@@ -0,0 +1,159 @@
+// i2c_dev.c
+//
+// Bus backend on a kernel I2C adapter (/dev/i2c-N: USB bridges, SoC
+// buses). The adapter does the framing, so a random read is one I2C_RDWR
+// ioctl with a write message for the word address and a read message for
+// the data, a page write is one message. SMBus-only adapters, like the
+// i2c-stub test module, get the same operations as SMBus I2C block
+// transfers of at most 32 bytes that don't cross a 256-byte block.
+
+#include <stdio.h>
+#include "i2c_dev.h"
+#include "msg.h"
+
+#ifdef __linux__
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+/* 7-bit address of the block holding addr on the selected chip */
+static int slaveAddr(I2CBus* bus, int addr) {
+	return (0x80 | bus->chipID | ((addr >> 7) & 0x0e)) >> 1;
+}
+
+int i2cdevOpen(I2CBus* bus, int n) {
+	char name[32];
+	unsigned long funcs = 0;
+	snprintf(name, sizeof(name), "/dev/i2c-%d", n);
+	bus->devFd = open(name, O_RDWR);
+	if (bus->devFd < 0) {
+		msg("Error opening '%s': %s\n", name, strerror(errno));
+		return 0;
+	}
+	if (ioctl(bus->devFd, I2C_FUNCS, &funcs) ||
+			!(funcs & (I2C_FUNC_I2C | I2C_FUNC_SMBUS_I2C_BLOCK))) {
+		msg("Error: '%s' supports neither I2C transfers nor SMBus I2C block transfers\n", name);
+		i2cdevClose(bus);
+		return 0;
+	}
+	bus->devFuncs = funcs;
+	bus->devSlave = -1;
+	msg("Using I2C adapter '%s'%s\n", name, funcs & I2C_FUNC_I2C ? "" : " (SMBus transfers)");
+	return 1;
+}
+
+void i2cdevClose(I2CBus* bus) {
+	if (bus->devFd >= 0)
+		close(bus->devFd);
+	bus->devFd = -1;
+}
+
+static int rdwr(I2CBus* bus, struct i2c_msg* m, int n) {
+	struct i2c_rdwr_ioctl_data data;
+	int i;
+	bus->stats.devMessages += n;
+	for (i = 0; i < n; i++)
+		bus->stats.devBytes += m[i].len;
+	data.msgs = m;
+	data.nmsgs = n;
+	return ioctl(bus->devFd, I2C_RDWR, &data) == n;
+}
+
+/* the SMBus ioctls address the chip set with I2C_SLAVE */
+static int smbus(I2CBus* bus, int slave, int rw, int cmd, int size, union i2c_smbus_data* d) {
+	struct i2c_smbus_ioctl_data args;
+	if (slave != bus->devSlave) {
+		if (ioctl(bus->devFd, I2C_SLAVE, slave)) {
+			msg("Error: address 0x%02X is busy, is a kernel driver bound to it?\n", slave);
+			return 0;
+		}
+		bus->devSlave = slave;
+	}
+	bus->stats.devMessages++;
+	bus->stats.devBytes += size == I2C_SMBUS_QUICK ? 0 : size == I2C_SMBUS_BYTE ? 1 : 1 + d->block[0];
+	args.read_write = rw;
+	args.command = cmd;
+	args.size = size;
+	args.data = d;
+	return !ioctl(bus->devFd, I2C_SMBUS, &args);
+}
+
+int i2cdevRead(I2CBus* bus, int addr, BYTE* b, int n) {
+	union i2c_smbus_data d;
+	int i, len;
+	if (bus->devFuncs & I2C_FUNC_I2C) {
+		BYTE word = addr & 0xff;
+		struct i2c_msg m[2] = {
+			{ slaveAddr(bus, addr), 0, 1, &word },
+			{ slaveAddr(bus, addr), I2C_M_RD, n, b },
+		};
+		return rdwr(bus, m, 2) ? n : -1;
+	}
+	for (i = 0; i < n; i += len) {
+		len = n - i < I2C_SMBUS_BLOCK_MAX ? n - i : I2C_SMBUS_BLOCK_MAX;
+		if (len > 256 - ((addr + i) & 0xff))
+			len = 256 - ((addr + i) & 0xff);
+		d.block[0] = len;
+		if (!smbus(bus, slaveAddr(bus, addr + i), I2C_SMBUS_READ, (addr + i) & 0xff, I2C_SMBUS_I2C_BLOCK_DATA, &d))
+			return -1;
+		memcpy(b + i, d.block + 1, len);
+	}
+	return n;
+}
+
+int i2cdevWrite(I2CBus* bus, int addr, const BYTE* b, int n) {
+	union i2c_smbus_data d;
+	BYTE buf[I2C_PAGE_SIZE + 1];
+	if (n > I2C_PAGE_SIZE)
+		return 0;
+	if (bus->devFuncs & I2C_FUNC_I2C) {
+		struct i2c_msg m = { slaveAddr(bus, addr), 0, n + 1, buf };
+		buf[0] = addr & 0xff;
+		memcpy(buf + 1, b, n);
+		return rdwr(bus, &m, 1);
+	}
+	d.block[0] = n;
+	memcpy(d.block + 1, b, n);
+	return smbus(bus, slaveAddr(bus, addr), I2C_SMBUS_WRITE, addr & 0xff, I2C_SMBUS_I2C_BLOCK_DATA, &d);
+}
+
+int i2cdevProbe(I2CBus* bus) {
+	union i2c_smbus_data d;
+	BYTE b;
+	struct i2c_msg m = { slaveAddr(bus, 0), I2C_M_RD, 1, &b };
+	// I2C_RDWR doesn't claim the address, so it works next to a bound at24 driver
+	if (bus->devFuncs & I2C_FUNC_I2C)
+		return rdwr(bus, &m, 1);
+	if (bus->devFuncs & I2C_FUNC_SMBUS_QUICK)
+		return smbus(bus, slaveAddr(bus, 0), I2C_SMBUS_WRITE, 0, I2C_SMBUS_QUICK, NULL);
+	return smbus(bus, slaveAddr(bus, 0), I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &d);
+}
+
+#else
+
+int i2cdevOpen(I2CBus* bus, int n) {
+	msg("Error: I2C adapters are only supported on Linux\n");
+	return 0;
+}
+
+void i2cdevClose(I2CBus* bus) {
+}
+
+int i2cdevRead(I2CBus* bus, int addr, BYTE* b, int n) {
+	return -1;
+}
+
+int i2cdevWrite(I2CBus* bus, int addr, const BYTE* b, int n) {
+	return 0;
+}
+
+int i2cdevProbe(I2CBus* bus) {
+	return 0;
+}
+
+#endif
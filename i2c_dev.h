@@ -0,0 +1,30 @@
+// i2c_dev.h
+#ifndef I2C_DEV_H_
+#define I2C_DEV_H_
+
+#include "i2c_comm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Drive the bus through the kernel adapter /dev/i2c-<n> instead of bit
+ * banging the LPT port. Linux only. Returns 1 on success.
+ */
+int i2cdevOpen(I2CBus* bus, int n);
+void i2cdevClose(I2CBus* bus);
+
+/* used by i2c_comm.c when bus->devFd is open */
+/* random read at addr of the selected chip, returns n or -1 */
+int i2cdevRead(I2CBus* bus, int addr, BYTE* b, int n);
+/* one page write, 1 = acknowledged */
+int i2cdevWrite(I2CBus* bus, int addr, const BYTE* b, int n);
+/* address the selected chip, 1 = acknowledged */
+int i2cdevProbe(I2CBus* bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* I2C_DEV_H_ */
@@ -0,0 +1,101 @@
+// i2c_wave.c
+//
+// Transaction compiler. Produces the same register writes, delays and SDA
+// samples as the i2c_start/i2c_send_bit/... primitives in i2c_comm.c, but
+// into a buffer that i2c_play replays in one loop.
+
+#include <stdlib.h>
+#include "i2c_comm.h"
+#include "i2c_wave.h"
+
+void waveInit(Wave* w, struct I2CBus* bus) {
+	w->bus = bus;
+	w->step = NULL;
+	w->count = w->size = w->samples = w->bits = 0;
+}
+
+void waveFree(Wave* w) {
+	free(w->step);
+	waveInit(w, w->bus);
+}
+
+void waveClear(Wave* w) {
+	w->count = w->samples = w->bits = 0;
+}
+
+void waveEmit(Wave* w, int out, int ticks, int flags) {
+	if (w->count == w->size) {
+		int size = w->size ? w->size * 2 : 256;
+		WaveStep* p = realloc(w->step, size * sizeof(WaveStep));
+		if (!p)
+			abort();
+		w->step = p;
+		w->size = size;
+	}
+	w->step[w->count].out = (BYTE)out;
+	w->step[w->count].ticks = (BYTE)ticks;
+	w->step[w->count].flags = (BYTE)flags;
+	w->count++;
+	if (flags & WAVE_SAMPLE)
+		w->samples++;
+}
+
+static void emit(Wave* w, int clk, int data, int ticks, int flags) {
+	waveEmit(w, i2c_encode(w->bus, clk, data), ticks, flags);
+}
+
+int waveStart(Wave* w) {
+	int tShort = w->bus->tShort, tNorm = w->bus->tNorm, i = w->samples;
+	emit(w, 0, 1, tShort, 0);
+	emit(w, 1, 1, tNorm, WAVE_SAMPLE | WAVE_IDLE);
+	emit(w, 1, 0, tNorm, 0);
+	emit(w, 0, 0, tShort, 0);
+	return i;
+}
+
+void waveStop(Wave* w) {
+	int tShort = w->bus->tShort, tNorm = w->bus->tNorm;
+	emit(w, 0, 0, tShort, 0);
+	emit(w, 1, 0, tNorm, 0);
+	emit(w, 1, 1, tNorm, 0);
+}
+
+void waveSendBit(Wave* w, int bit) {
+	int tShort = w->bus->tShort, tNorm = w->bus->tNorm;
+	bit &= 1;
+	w->bits++;
+	emit(w, 0, bit, tShort, 0);
+	emit(w, 1, bit, tNorm, 0);
+	emit(w, 0, bit, tShort, 0);
+}
+
+int waveRecvBit(Wave* w) {
+	int tShort = w->bus->tShort, tNorm = w->bus->tNorm, i = w->samples;
+	emit(w, 0, 1, tShort, 0);
+	emit(w, 1, 1, tNorm, WAVE_SAMPLE);
+	emit(w, 0, 1, tShort, 0);
+	return i;
+}
+
+int waveSendByte(Wave* w, int b) {
+	int i;
+	for (i = 7; i >= 0; i--)
+		waveSendBit(w, b >> i);
+	return waveRecvBit(w);
+}
+
+int waveRecvByte(Wave* w, int ack) {
+	int i, first = w->samples;
+	for (i = 0; i < 8; i++)
+		waveRecvBit(w);
+	if (ack)
+		waveRecvBit(w);
+	return first;
+}
+
+int waveByte(const BYTE* samples, int i) {
+	int j, b = 0;
+	for (j = 0; j < 8; j++)
+		b = (b << 1) | samples[i + j];
+	return b;
+}
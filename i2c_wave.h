@@ -0,0 +1,54 @@
+// i2c_wave.h
+#ifndef I2C_WAVE_H_
+#define I2C_WAVE_H_
+
+#include "port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WAVE_SAMPLE 1 /* sample SDA after the delay */
+#define WAVE_IDLE   2 /* sample must be 1, else repeat from the previous step */
+
+typedef struct {
+	BYTE out;   /* output register value */
+	BYTE ticks; /* delay after the write */
+	BYTE flags;
+} WaveStep;
+
+struct I2CBus;
+
+/* a whole transaction as a flat list of register writes */
+typedef struct {
+	struct I2CBus* bus; /* timing source */
+	WaveStep* step;
+	int count, size;
+	int samples;
+	int bits; /* bits sent */
+} Wave;
+
+void waveInit(Wave* w, struct I2CBus* bus);
+void waveFree(Wave* w);
+void waveClear(Wave* w);
+/* append one register write, for compilers with their own line encoding */
+void waveEmit(Wave* w, int out, int ticks, int flags);
+
+/* the compilers return the index of their first sample */
+int waveStart(Wave* w);
+void waveStop(Wave* w);
+void waveSendBit(Wave* w, int bit);
+int waveRecvBit(Wave* w);
+/* 8 data bits and the ACK sample */
+int waveSendByte(Wave* w, int b);
+/* 8 data bits, followed by an ACK if ack is set */
+int waveRecvByte(Wave* w, int ack);
+
+/* assemble the byte sampled at index i */
+int waveByte(const BYTE* samples, int i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* I2C_WAVE_H_ */
@@ -0,0 +1,69 @@
+// image.c
+//
+// Most operations only look at a few fields: the color and serial number
+// at 0x28, the counters at 0x58-0xA5, the signature at 0xF0. The image
+// keeps track of which bytes have been read, so each field costs one short
+// random read and the whole chip is only read for backups and diffs.
+
+#include <string.h>
+#include "image.h"
+#include "msg.h"
+
+#define IS_VALID(img, i) ((img)->valid[(i) >> 3] & (1 << ((i) & 7)))
+
+void imageInit(Image* img, I2CBus* bus, int size) {
+	img->bus = bus;
+	img->size = size;
+	// bytes not read yet are copied into backups and write plans as they are
+	memset(img->data, 0xff, sizeof(img->data));
+	imageClear(img);
+}
+
+void imageClear(Image* img) {
+	memset(img->valid, 0, sizeof(img->valid));
+}
+
+static void setValid(Image* img, int addr, int n) {
+	int i;
+	for (i = addr; i < addr + n; i++)
+		img->valid[i >> 3] |= 1 << (i & 7);
+}
+
+static const BYTE* fetch(Image* img, int addr, int n, int probe) {
+	int first, last, rc;
+	if (addr < 0 || n < 0 || addr + n > img->size)
+		return NULL;
+	for (first = addr; first < addr + n && IS_VALID(img, first); first++)
+		;
+	for (last = addr + n - 1; last >= first && IS_VALID(img, last); last--)
+		;
+	if (first <= last) {
+		n = last - first + 1;
+		rc = probe ? i2c_probe_read(img->bus, first, img->data + first, n)
+				: i2c_read_bytes(img->bus, first, img->data + first, n);
+		if (rc < n) {
+			if (!probe)
+				msg("Error reading data at offset %d\n", first + (rc > 0 ? rc : 0));
+			return NULL;
+		}
+		setValid(img, first, n);
+	}
+	return img->data + addr;
+}
+
+const BYTE* imageFetch(Image* img, int addr, int n) {
+	return fetch(img, addr, n, 0);
+}
+
+const BYTE* imageProbe(Image* img, int addr, int n) {
+	return fetch(img, addr, n, 1);
+}
+
+BYTE* imageAll(Image* img) {
+	return fetch(img, 0, img->size, 0) ? img->data : NULL;
+}
+
+void imageStore(Image* img, int addr, const BYTE* b, int n) {
+	memcpy(img->data + addr, b, n);
+	setValid(img, addr, n);
+}
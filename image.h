@@ -0,0 +1,40 @@
+// image.h
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include "i2c_comm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IMAGE_MAX 2048
+
+/* the contents of the selected chip, read from it on demand */
+typedef struct {
+	I2CBus* bus;
+	int size;
+	BYTE data[IMAGE_MAX];
+	BYTE valid[IMAGE_MAX / 8]; /* bit set = byte read */
+} Image;
+
+void imageInit(Image* img, I2CBus* bus, int size);
+/* forget everything read, e.g. after selecting another chip */
+void imageClear(Image* img);
+/*
+ * Bytes addr to addr + n - 1 of the chip, reading the ones not read yet
+ * with a single random read. Returns a pointer into data or NULL.
+ */
+const BYTE* imageFetch(Image* img, int addr, int n);
+/* like imageFetch, but quietly returns NULL if the chip doesn't answer */
+const BYTE* imageProbe(Image* img, int addr, int n);
+/* the whole image, NULL on error */
+BYTE* imageAll(Image* img);
+/* record bytes written to the chip */
+void imageStore(Image* img, int addr, const BYTE* b, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IMAGE_H_ */
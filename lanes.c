@@ -0,0 +1,453 @@
+// lanes.c
+//
+// Bit-sliced bus for several cartridges on one port. The transactions are
+// compiled into the same Wave steps as in i2c_wave.c, but each step holds
+// the SDA level of every lane, so all lanes shift their own bytes (their
+// own device and word addresses too) on the shared clock. A lane that
+// isn't part of a transaction keeps SDA high and sees no START.
+//
+//  lane  SDA out     SDA in
+//  0     pin 2 (D0)  pin 10 (/ACK)
+//  1     pin 3 (D1)  pin 11 (BUSY)
+//  2     pin 4 (D2)  pin 12 (PE)
+//  3     pin 5 (D3)  pin 13 (SEL)
+//  4     pin 6 (D4)  pin 15 (/ERROR)
+//  SCL   pin 9 (D7)
+
+#include <stdlib.h>
+#include <string.h>
+#include "port.h"
+#include "utimer.h"
+#include "lanes.h"
+#include "msg.h"
+
+#define LANE_SCL 0x80 /* D7 */
+#define LANE_SDA 0x1f /* D0-D4 */
+#define I2C_WRITE 0x80
+#define I2C_READ 0x81
+#define WRITE_RETRY 2          /* rewrites of a cycle a lane didn't acknowledge */
+#define WRITE_CYCLE_MAX 20000  /* us */
+
+static const struct {
+	int bit, inv;
+	const char* pins;
+} lanes[LANES_MAX] = {
+	{ 6, 0, "SDA pin 2 (D0), read back on pin 10 (/ACK)" },
+	{ 7, 1, "SDA pin 3 (D1), read back on pin 11 (BUSY)" },
+	{ 5, 0, "SDA pin 4 (D2), read back on pin 12 (PE)" },
+	{ 4, 0, "SDA pin 5 (D3), read back on pin 13 (SEL)" },
+	{ 3, 0, "SDA pin 6 (D4), read back on pin 15 (/ERROR)" },
+};
+
+void lanesInit(LaneBus* l, I2CBus* bus, int count) {
+	int i, v;
+	memset(l, 0, sizeof(*l));
+	l->bus = bus;
+	l->count = count < LANES_MAX ? count : LANES_MAX;
+	waveInit(&l->wave, bus);
+	// the lanes drive the data pins, which bit 5 of the control register would make inputs
+	outp(bus->basePort + 2, I2C_CONTROL_FORWARD);
+	// decode the status register with one lookup per sample
+	for (v = 0; v < 256; v++) {
+		for (i = 0; i < LANES_MAX; i++)
+			l->status[v] |= (((v >> lanes[i].bit) & 1) ^ lanes[i].inv) << i;
+	}
+}
+
+void lanesFree(LaneBus* l) {
+	waveFree(&l->wave);
+	free(l->samples);
+	l->samples = NULL;
+	l->samplesSize = 0;
+}
+
+const char* lanesPins(int lane) {
+	return lane >= 0 && lane < LANES_MAX ? lanes[lane].pins : NULL;
+}
+
+static void set(LaneBus* l, int clk, int sda) {
+	l->bus->stats.portWrites++;
+	outp(l->bus->basePort, (clk ? LANE_SCL : 0) | (sda & LANE_SDA));
+}
+
+static int get(LaneBus* l) {
+	l->bus->stats.portReads++;
+	return l->status[inp(l->bus->basePort + 1)];
+}
+
+/* the step patterns of i2c_wave.c, sda a mask of the lanes left high */
+static void emit(LaneBus* l, int clk, int sda, int ticks, int flags) {
+	waveEmit(&l->wave, (clk ? LANE_SCL : 0) | ((sda | ~l->mask) & LANE_SDA), ticks, flags);
+}
+
+static void compile(LaneBus* l, int mask) {
+	waveClear(&l->wave);
+	l->mask = mask;
+}
+
+static void start(LaneBus* l) {
+	int tShort = l->bus->tShort, tNorm = l->bus->tNorm;
+	emit(l, 0, LANE_SDA, tShort, 0);
+	emit(l, 1, LANE_SDA, tNorm, WAVE_SAMPLE | WAVE_IDLE);
+	emit(l, 1, 0, tNorm, 0);
+	emit(l, 0, 0, tShort, 0);
+}
+
+static void stop(LaneBus* l) {
+	int tShort = l->bus->tShort, tNorm = l->bus->tNorm;
+	emit(l, 0, 0, tShort, 0);
+	emit(l, 1, 0, tNorm, 0);
+	emit(l, 1, LANE_SDA, tNorm, 0);
+}
+
+static void sendBit(LaneBus* l, int sda) {
+	int tShort = l->bus->tShort, tNorm = l->bus->tNorm;
+	l->wave.bits++;
+	emit(l, 0, sda, tShort, 0);
+	emit(l, 1, sda, tNorm, 0);
+	emit(l, 0, sda, tShort, 0);
+}
+
+static int recvBit(LaneBus* l) {
+	int tShort = l->bus->tShort, tNorm = l->bus->tNorm, i = l->wave.samples;
+	emit(l, 0, LANE_SDA, tShort, 0);
+	emit(l, 1, LANE_SDA, tNorm, WAVE_SAMPLE);
+	emit(l, 0, LANE_SDA, tShort, 0);
+	return i;
+}
+
+/* byte b[i] on lane i, returns the index of the ACK sample */
+static int sendByte(LaneBus* l, const int* b) {
+	int i, j, sda;
+	for (j = 7; j >= 0; j--) {
+		for (sda = 0, i = 0; i < l->count; i++)
+			sda |= ((b[i] >> j) & 1) << i;
+		sendBit(l, sda);
+	}
+	return recvBit(l);
+}
+
+static int recvByte(LaneBus* l) {
+	int j, first = l->wave.samples;
+	for (j = 0; j < 8; j++)
+		recvBit(l);
+	return first;
+}
+
+static int laneByte(const BYTE* samples, int i, int lane) {
+	int j, b = 0;
+	for (j = 0; j < 8; j++)
+		b = (b << 1) | ((samples[i + j] >> lane) & 1);
+	return b;
+}
+
+/* the device address of each lane for addr[i] */
+static void devAddr(LaneBus* l, int rw, const int* addr, int* b) {
+	int i;
+	for (i = 0; i < l->count; i++)
+		b[i] = rw | l->chipID[i] | ((addr[i] >> 7) & 0x0e);
+}
+
+/*
+ * Replay the compiled transaction, like i2c_play. A lane still holding SDA
+ * low after 10 tries at a START is given up for this transaction instead
+ * of clearing the bus for everyone, later STARTs don't wait for it.
+ * Returns the lanes left.
+ */
+static int play(LaneBus* l) {
+	I2CBus* bus = l->bus;
+	const Wave* w = &l->wave;
+	const WaveStep* s;
+	const unsigned short out = bus->basePort, in = bus->basePort + 1;
+	int i, n = 0, tries = 10, mask = l->mask;
+	long long start = timerNanos(), spin = timerSpinNanos();
+	if (l->samplesSize < w->samples) {
+		BYTE* p = realloc(l->samples, w->samples);
+		if (!p)
+			return 0;
+		l->samples = p;
+		l->samplesSize = w->samples;
+	}
+	l->stuck = 0;
+	bus->stats.portWrites += w->count;
+	bus->stats.bitsSent += w->bits;
+	for (i = 0; i < w->count; i++) {
+		s = w->step + i;
+		outp(out, s->out);
+		timerWait(s->ticks);
+		if (s->flags & WAVE_SAMPLE) {
+			BYTE sda = l->status[inp(in)];
+			bus->stats.portReads++;
+			if ((s->flags & WAVE_IDLE) && (sda & mask) != mask) {
+				if (--tries) {
+					bus->stats.startRetries++;
+					bus->stats.portWrites += 2;
+					i -= 2;
+					continue;
+				}
+				l->stuck |= mask & ~sda;
+				mask &= ~l->stuck;
+			}
+			tries = 10;
+			if (!(s->flags & WAVE_IDLE))
+				bus->stats.bitsRead++;
+			l->samples[n++] = sda;
+		}
+	}
+	bus->stats.waveNanos += timerNanos() - start;
+	bus->stats.waveSpinNanos += timerSpinNanos() - spin;
+	return mask;
+}
+
+int lanesCount(int mask) {
+	int n = 0;
+	for (; mask; mask &= mask - 1)
+		n++;
+	return n;
+}
+
+int lanesProbe(LaneBus* l, int mask) {
+	int b[LANES_MAX], zero[LANES_MAX] = { 0 }, ack, ok;
+	mask &= (1 << l->count) - 1;
+	compile(l, mask);
+	start(l);
+	devAddr(l, I2C_WRITE, zero, b);
+	ack = sendByte(l, b);
+	stop(l);
+	l->bus->stats.probes++;
+	if (!(ok = play(l)))
+		return 0;
+	return ok & ~l->samples[ack];
+}
+
+void lanesClear(LaneBus* l, int mask) {
+	I2CBus* bus = l->bus;
+	int i;
+	bus->stats.busClears++;
+	set(l, 0, LANE_SDA);
+	timerWait(bus->tShort);
+	for (i = 0; i < 9 && (get(l) & mask) != mask; i++) {
+		set(l, 1, LANE_SDA);
+		timerWait(bus->tNorm);
+		set(l, 0, LANE_SDA);
+		timerWait(bus->tShort);
+	}
+	// STOP on the cleared lanes only
+	set(l, 0, ~mask);
+	timerWait(bus->tShort);
+	set(l, 1, ~mask);
+	timerWait(bus->tNorm);
+	set(l, 1, LANE_SDA);
+	timerWait(bus->tNorm);
+}
+
+/*
+ * One sequential read of n bytes at addr[i] on each lane, of which the
+ * first count[i] go to b[i]. Returns the lanes acknowledged.
+ */
+static int readPass(LaneBus* l, int mask, const int* addr, BYTE** b, const int* count, int n) {
+	int i, j, dev, word, rd, data, ok, v[LANES_MAX];
+	compile(l, mask);
+	start(l);
+	devAddr(l, I2C_WRITE, addr, v);
+	dev = sendByte(l, v);
+	for (i = 0; i < l->count; i++)
+		v[i] = addr[i] & 0xff;
+	word = sendByte(l, v);
+	start(l);
+	devAddr(l, I2C_READ, addr, v);
+	rd = sendByte(l, v);
+	data = l->wave.samples;
+	for (j = 0; j < n; j++) {
+		if (j)
+			sendBit(l, 0);
+		recvByte(l);
+	}
+	stop(l);
+	if (!(ok = play(l)))
+		return 0;
+	ok &= ~(l->samples[dev] | l->samples[word] | l->samples[rd]);
+	l->bus->stats.nacks += lanesCount(mask & ~ok);
+	for (i = 0; i < l->count; i++) {
+		if (ok & (1 << i)) {
+			for (j = 0; j < count[i]; j++)
+				b[i][j] = (BYTE)laneByte(l->samples, data + j * 8, i);
+		}
+	}
+	return ok;
+}
+
+/* lanesRead with its own address and length on each lane */
+static int readLanes(LaneBus* l, int mask, const int* addr, BYTE** b, const int* n) {
+	BYTE* dst[LANES_MAX];
+	int done[LANES_MAX], pending[LANES_MAX], retry[LANES_MAX], size[LANES_MAX], chunk[LANES_MAX], a[LANES_MAX];
+	int i, len, run, read, ok, last, clear;
+	run = mask & ((1 << l->count) - 1);
+	for (i = 0; i < LANES_MAX; i++) {
+		done[i] = pending[i] = 0;
+		retry[i] = I2C_READ_RETRY;
+		size[i] = n[i]; // one transaction, in chunks once the lane failed
+		a[i] = addr[i];
+		if (!n[i])
+			run &= ~(1 << i);
+	}
+	while (run) {
+		// the longest chunk left, the lanes at their last one read past it
+		for (len = 0, i = 0; i < l->count; i++) {
+			chunk[i] = n[i] - done[i] < size[i] ? n[i] - done[i] : size[i];
+			a[i] = addr[i] + done[i];
+			dst[i] = (run & (1 << i)) ? b[i] + done[i] : NULL;
+			if ((run & (1 << i)) && chunk[i] > len)
+				len = chunk[i];
+		}
+		read = readPass(l, run, a, dst, chunk, len);
+		// the next chunk's address confirms a chunk, the last needs a probe
+		for (last = 0, i = 0; i < l->count; i++) {
+			if ((read & (1 << i)) && done[i] + chunk[i] == n[i] && n[i] > I2C_READ_CHUNK)
+				last |= 1 << i;
+		}
+		ok = read & ~(last & ~(last ? lanesProbe(l, last) : 0));
+		for (clear = 0, i = 0; i < l->count; i++) {
+			if (!(run & (1 << i)))
+				continue;
+			if (ok & (1 << i)) {
+				done[i] += chunk[i];
+				pending[i] = 1;
+				if (done[i] == n[i])
+					run &= ~(1 << i);
+				continue;
+			}
+			if (!(read & (1 << i)) && pending[i])
+				done[i] -= I2C_READ_CHUNK; // the chunk before may be garbage too
+			pending[i] = 0;
+			if (!retry[i]--) {
+				run &= ~(1 << i);
+				continue;
+			}
+			msg("Read failed on lane %d at offset %d, clearing the lane and resuming\n", i + 1, addr[i] + done[i]);
+			l->bus->stats.readRetries++;
+			size[i] = I2C_READ_CHUNK;
+			clear |= 1 << i;
+		}
+		if (clear) {
+			lanesClear(l, clear);
+			SleepEx(2, 0);
+		}
+	}
+	for (ok = 0, i = 0; i < l->count; i++) {
+		if ((mask & (1 << i)) && done[i] == n[i])
+			ok |= 1 << i;
+	}
+	return ok;
+}
+
+int lanesRead(LaneBus* l, int mask, int addr, BYTE** b, int n) {
+	int a[LANES_MAX], len[LANES_MAX], i;
+	for (i = 0; i < LANES_MAX; i++) {
+		a[i] = addr;
+		len[i] = n;
+	}
+	return readLanes(l, mask, a, b, len);
+}
+
+int lanesReadPlan(LaneBus* l, int mask, const WritePlan* plan, BYTE** b) {
+	BYTE* dst[LANES_MAX];
+	int a[LANES_MAX], n[LANES_MAX], i, k, run, ok = mask & ((1 << l->count) - 1);
+	for (k = 0; ; k++) {
+		for (run = 0, i = 0; i < LANES_MAX; i++) {
+			a[i] = n[i] = 0;
+			dst[i] = NULL;
+			if ((ok & (1 << i)) && k < plan[i].count) {
+				a[i] = plan[i].range[k].addr;
+				n[i] = plan[i].range[k].n;
+				dst[i] = b[i] + a[i];
+				run |= 1 << i;
+			}
+		}
+		if (!run)
+			return ok;
+		ok &= ~run | readLanes(l, run, a, dst, n);
+	}
+}
+
+/* one page write of n bytes at addr[i] from want[i] on each lane, returns the lanes acknowledged */
+static int writePass(LaneBus* l, int mask, const int* addr, BYTE** want, int n) {
+	int i, j, ok, ack[I2C_PAGE_SIZE + 2], v[LANES_MAX];
+	compile(l, mask);
+	start(l);
+	devAddr(l, I2C_WRITE, addr, v);
+	ack[0] = sendByte(l, v);
+	for (i = 0; i < l->count; i++)
+		v[i] = addr[i] & 0xff;
+	ack[1] = sendByte(l, v);
+	for (j = 0; j < n; j++) {
+		for (i = 0; i < l->count; i++)
+			v[i] = mask & (1 << i) ? want[i][addr[i] + j] : 0xff;
+		ack[j + 2] = sendByte(l, v);
+	}
+	stop(l);
+	if (!(ok = play(l)))
+		return 0;
+	for (j = 0; j < n + 2; j++)
+		ok &= ~l->samples[ack[j]];
+	l->bus->stats.nacks += lanesCount(mask & ~ok);
+	return ok;
+}
+
+/* ACK polling of all lanes at once, returns the lanes done within WRITE_CYCLE_MAX */
+static int waitWrite(LaneBus* l, int mask) {
+	I2CBus* bus = l->bus;
+	long long start = timerMicros();
+	int busy = mask, phase = i2c_phase(bus, I2C_PHASE_ACKPOLL);
+	while (busy && timerMicros() - start < WRITE_CYCLE_MAX) {
+		busy &= ~lanesProbe(l, busy);
+		bus->stats.ackPolls++;
+	}
+	i2c_phase(bus, phase);
+	return mask & ~busy;
+}
+
+int lanesWrite(LaneBus* l, int mask, const WritePlan* plan, BYTE** want) {
+	int next[LANES_MAX] = { 0 }, tries[LANES_MAX] = { 0 }, a[LANES_MAX] = { 0 };
+	int i, len, run, ok, clear, failed = 0, phase = i2c_phase(l->bus, I2C_PHASE_WRITE);
+	for (run = 0, i = 0; i < l->count; i++) {
+		if ((mask & (1 << i)) && plan[i].count)
+			run |= 1 << i;
+	}
+	while (run) {
+		/*
+		 * All lanes shift the same number of bytes, the shorter ranges are
+		 * widened within their page with the bytes wanted there anyway.
+		 */
+		for (len = 0, i = 0; i < l->count; i++) {
+			if ((run & (1 << i)) && plan[i].range[next[i]].n > len)
+				len = plan[i].range[next[i]].n;
+		}
+		for (i = 0; i < l->count; i++) {
+			const WriteRange* r = &plan[i].range[next[i]];
+			int end = (r->addr & ~(I2C_PAGE_SIZE - 1)) + I2C_PAGE_SIZE;
+			if (run & (1 << i))
+				a[i] = r->addr < end - len ? r->addr : end - len;
+		}
+		ok = waitWrite(l, writePass(l, run, a, want, len));
+		for (clear = 0, i = 0; i < l->count; i++) {
+			if (!(run & (1 << i)))
+				continue;
+			if (ok & (1 << i)) {
+				tries[i] = 0;
+				if (++next[i] == plan[i].count)
+					run &= ~(1 << i);
+			} else if (tries[i]++ == WRITE_RETRY) {
+				msg("Error writing data on lane %d at offset %d\n", i + 1, a[i]);
+				failed |= 1 << i;
+				run &= ~(1 << i);
+			} else {
+				clear |= 1 << i;
+			}
+		}
+		if (clear)
+			lanesClear(l, clear);
+	}
+	i2c_phase(l->bus, phase);
+	return mask & ~failed & ((1 << l->count) - 1);
+}
@@ -0,0 +1,65 @@
+// lanes.h
+#ifndef LANES_H_
+#define LANES_H_
+
+#include "i2c_comm.h"
+#include "wplan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LANES_MAX 5 /* one per status input */
+
+/*
+ * Several cartridges on one LPT port, bit-sliced. SCL is shared on D7
+ * (pin 9) and lane i drives its own SDA on data bit i through an
+ * open-collector driver and reads it back on a status line, so an edge
+ * is one data register write and a sample one status read for all lanes.
+ * Lane masks have bit i set for lane i.
+ */
+typedef struct {
+	I2CBus* bus;            /* port, timing and counters */
+	int count;              /* lanes wired */
+	int chipID[LANES_MAX];  /* device select bits per lane, as I2CBus.chipID */
+	int mask;               /* lanes of the transaction being compiled */
+	int stuck;              /* lanes that held SDA low at a START */
+	Wave wave;
+	BYTE* samples;          /* SDA of all lanes, one mask per sample */
+	int samplesSize;
+	BYTE status[256];       /* status register value to SDA mask */
+} LaneBus;
+
+void lanesInit(LaneBus* l, I2CBus* bus, int count);
+void lanesFree(LaneBus* l);
+/* the pins of a lane, for the wiring help */
+const char* lanesPins(int lane);
+/* the lanes of mask whose chip acknowledges its address */
+int lanesProbe(LaneBus* l, int mask);
+/*
+ * Read n bytes at addr into b[i] for each lane i of mask. Every lane
+ * resumes after errors on its own, as i2c_read_bytes does, while the
+ * others go on. Returns the lanes that read all n bytes.
+ */
+int lanesRead(LaneBus* l, int mask, int addr, BYTE** b, int n);
+/*
+ * Read back the ranges of plan[i] into b[i], at their addresses, on each
+ * lane i of mask, as wplanVerify does. Returns the lanes that read them all.
+ */
+int lanesReadPlan(LaneBus* l, int mask, const WritePlan* plan, BYTE** b);
+/*
+ * Execute plan[i] from want[i] on each lane i of mask, one cycle per lane
+ * at a time. A lane that doesn't acknowledge is cleared and retried alone.
+ * Returns the lanes whose plan completed.
+ */
+int lanesWrite(LaneBus* l, int mask, const WritePlan* plan, BYTE** want);
+/* the number of lanes in mask */
+int lanesCount(int mask);
+/* free the lanes of mask whose chip holds SDA low */
+void lanesClear(LaneBus* l, int mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LANES_H_ */
@@ -1,32 +1,81 @@
 // main.c
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "getopt.h"
-#include "pt_ioctl.h"
+#include "port.h"
 #include "i2c_comm.h"
+#include "sim24c16.h"
+#include "wplan.h"
+#include "config.h"
+#include "calib.h"
+#include "pool.h"
+#include "msg.h"
+#include "server.h"
+#include "store.h"
+#include "image.h"
+#include "vcd.h"
+#include "ppdev.h"
+#include "i2c_dev.h"
+#include "gpio.h"
+#include "lanes.h"
 #include "data/clean_C.h"
 #include "data/clean_M.h"
 #include "data/clean_Y.h"
 #include "data/clean_K.h"
 #include "data/clean_I.h"
 
+static void printBanner() {
+	printf("SSEBR For Windows version 2.0\n"
+			"Sad Samsung CLP-510 EEPROM Backup/Restore utility\n\n");
+}
+
 static void printUsage(char* argv0) {
 	printf("Usage %s [options]\n\nbasic commands:\n\n"
 			" -w             = print wiring information\n"
-			" -p <port>      = set LPT port (1, 2 or 3)\n"
+			" -p <ports>     = set LPT port (1, 2 or 3), or several, e.g. 1,2,3\n"
 			" -i             = view chip information\n"
 			" -z             = zero out page counter\n\n"
 			"advanced commands (for debugging):\n\n"
 			" -b <file name> = backup EEPROM\n"
-			" -r <file name> = restore EEPROM\n"
-			" -n             = don't auto-save backup\n"
+			" -r <file name> = restore EEPROM, from the last stored backup of the\n"
+			"                  cartridge with @ or a stored backup with @<id>\n"
+			" -n             = don't store a backup before zeroing out\n"
 			" -f             = force incompatible write\n"
-			" -s             = scan the I2C bus\n"
+			" -s             = monitor the port for cartridges, running -i, -b, -r\n"
+			"                  or -z on each one inserted\n"
+			" -a             = access all 2 KB of a 24C16 (default 512 bytes)\n"
+			" -c             = calibrate the bus timing of the port\n"
+			" -v <file name> = verify EEPROM against a file\n"
+			" -j <file name> = run a job list, one '<port> <action> [file]' per line\n"
+			"                  with action info, backup, restore, reset or verify,\n"
+			"                  waiting for the next cartridge between lines\n"
+			" -d <socket>    = run as a daemon taking jobs on a Unix socket\n"
+			" -u <socket> <port> <action> [file]\n"
+			"                = send a job to the daemon\n"
+			" -x <image>     = use a simulated chip loaded from an image file\n"
+			"                  or a clean image (C, M, Y, K or I); with -m a list\n"
+			"                  of one per lane, - for none, <image>!<n> holds\n"
+			"                  SDA low for n clocks, <image>@<clock>:<n> loses\n"
+			"                  power for n clocks\n"
+			" -y <adapter>   = use the kernel I2C adapter /dev/i2c-<adapter>\n"
+			" -o <chip>:<sda>,<scl>\n"
+			"                = use two GPIO lines, e.g. gpiochip0:17,27\n"
+			" -l <wiring>    = wiring of the LPT port, see -w for the profiles\n"
+			" -m <lanes>     = serve up to 5 cartridges on the data pins of the\n"
+			"                  port at once, with -i, -b, -r, -z or -v\n"
+			" -g <file name> = capture the bus lines of each task to a VCD file\n"
+			" -t <file name> = append bus counters and phase times of each task\n"
+			"                  and the totals of the run to a file, one JSON\n"
+			"                  object per line\n"
 			, argv0);
 }
 
 static void printWiring() {
+	const I2CWiring* w;
+	int i;
 	printf("Connecting catridge to parallel port:\n"
 			"\n"
 			"25-pin LPT connector at the PC:\n"
@@ -54,66 +103,1206 @@ static void printWiring() {
 			"                 |     \\  +++++++  |      |\n"
 			"                 +------------------------+\n"
 			"\n"
-			);
+			"Wiring profiles, selected with -l <name> or <port>.wiring in %s:\n"
+			"\n", CONFIG_FILE);
+	for (i = 0; (w = i2c_wiring(i)); i++)
+		printf("  %-9s %s\n", w->name, w->pins);
+	printf("\nMulti-lane mode (-m), SCL of all lanes on pin 9 (D7):\n\n");
+	for (i = 0; lanesPins(i); i++)
+		printf("  lane %d    %s\n", i + 1, lanesPins(i));
+	printf("\n");
 }
 
+#define VERIFY_RETRY 2 // rewrites of a range that fails verification
+
+static char* chipNames[] = {"Unknown", "ImageBelt", "Yellow", "Magenta", "Cyan", "Black"};
+static char imageTypes[] = { 0, 'i', 'y', 'm', 'c', 'k'}; // stored at offset 0x28 and sometimes 0xE0
+static int     chipIDs[] = { 0,   0,   0,   1,   2,   3};
+static int   extUpdate[] = { 0,   0,   1,   1,   1,   1}; // extended update
+static BYTE* cleanData[] = { 0, clean_I, clean_Y, clean_M, clean_C, clean_K };
+
 int int4(BYTE* buf) {
 	return (buf[0]<<24)|(buf[1]<<16)|(buf[2]<<8)|(buf[3]);
 }
 
+static int findImageType(char imageType) {
+	int imageTypeID;
+	for (imageTypeID = 1; imageTypeID < sizeof(imageTypes); imageTypeID++) {
+		if (imageTypes[imageTypeID] == imageType)
+			break;
+	}
+	if (imageTypeID >= sizeof(imageTypes))
+		imageTypeID = 0;
+	return imageTypeID;
+}
+
+/* options shared by all port jobs */
+static struct {
+	char* readFname;
+	char* writeFname;
+	char* verifyFname;
+	int size;
+	int force;
+	int nobackup;
+	int zeroOut;
+	int info;
+	int scan;
+	int calibrate;
+	char* jobList;
+	char* daemon;
+	char* client;
+	char* simImage;
+	char* statsFname;
+	char* captureFname;
+	int i2cAdapter;
+	char* gpioLines;
+	char* wiring;
+	int lanes;
+	int multiPort;
+} opt;
+
+/* the actions for one cartridge */
+typedef struct {
+	int port;
+	char* readFname;
+	char* writeFname;
+	char* verifyFname;
+	int zeroOut;
+	int seq; /* job number, 0 when run once from the command line */
+	int lane; /* 1-based lane in multi-lane mode, for the file names */
+} Task;
+
+typedef struct {
+	int port;
+	char portName[8];
+	I2CBus bus;
+	int lastChip; /* chip select ID found last on the port, -1 if none */
+	int rc;
+#ifndef _WIN32
+	RequestQueue queue; /* daemon requests for the port */
+#endif
+} Job;
+
+static Task* tasks;
+static int taskCount;
+static Job jobs[3];
+static int jobCount;
+
+#define MONITOR_FAST 50  // ms between presence probes while a cartridge is seated
+#define MONITOR_SLOW 800 // longest interval while the port stays empty
+#define DETECT_RETRY 5 // probe passes before a port counts as empty
+#define CHARGE_MAX 1000 // ms of charging before a port counts as empty
+#define CHARGE_STEP 5   // ms of charging between probes
+#define CHARGE_ACKS 3   // probes in a row that must answer
+
+static int portAddress(int port) {
+	switch (port) {
+	case 1:
+		return 0x378;
+	case 2:
+		return 0x278;
+	case 3:
+		return 0x3bc;
+	}
+	return 0;
+}
+
+/*
+ * With several ports at once, output files get the port name appended;
+ * in monitor mode also the job number, one file per cartridge, and in
+ * multi-lane mode the lane.
+ */
+static char* jobFileName(Job* job, const Task* task, char* fname, char* out, int len) {
+	char suffix[16] = "", *ext;
+	if (opt.multiPort)
+		snprintf(suffix, sizeof(suffix), "_%s", job->portName);
+	if (opt.scan)
+		snprintf(suffix + strlen(suffix), sizeof(suffix) - strlen(suffix), "_%d", task->seq);
+	if (task->lane)
+		snprintf(suffix + strlen(suffix), sizeof(suffix) - strlen(suffix), "_L%d", task->lane);
+	if (!suffix[0])
+		return fname;
+	ext = strrchr(fname, '.');
+	if (!ext || strpbrk(ext, "/\\"))
+		ext = fname + strlen(fname);
+	snprintf(out, len, "%.*s%s%s", (int)(ext - fname), fname, suffix, ext);
+	return out;
+}
+
+/*
+ * One cartridge job as "<port> <action> [file]", where the action is
+ * info, backup <file>, restore <file>, reset [backup file] (or zero) or
+ * verify <file>. Used by job lists and daemon requests.
+ */
+static int parseTask(Task* t, const char* line) {
+	char action[16], file[256] = "";
+	memset(t, 0, sizeof(*t));
+	if (sscanf(line, "%d %15s %255s", &t->port, action, file) < 2 || !portAddress(t->port))
+		return 0;
+	if (!strcmp(action, "info")) {
+	} else if (!strcmp(action, "backup") && file[0]) {
+		t->readFname = strdup(file);
+	} else if (!strcmp(action, "restore") && file[0]) {
+		t->writeFname = strdup(file);
+	} else if (!strcmp(action, "reset") || !strcmp(action, "zero")) {
+		t->zeroOut = 1;
+		if (file[0])
+			t->readFname = strdup(file);
+	} else if (!strcmp(action, "verify") && file[0]) {
+		t->verifyFname = strdup(file);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Job list: one cartridge per line, see parseTask. Lines for different
+ * ports run in parallel, each port in list order with the cartridge
+ * swapped in between.
+ */
+static int loadJobList(char* fname) {
+	char line[300];
+	int lineNo = 0;
+	FILE* f = fopen(fname, "r");
+	if (!f) {
+		printf("Error reading file '%s'\n", fname);
+		return 0;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		lineNo++;
+		if (line[strspn(line, " \t\r\n")] == 0 || line[strspn(line, " \t")] == '#')
+			continue;
+		if (!(tasks = realloc(tasks, (taskCount + 1) * sizeof(Task))))
+			break;
+		if (!parseTask(&tasks[taskCount], line)) {
+			printf("%s:%d: invalid job, expected '<port> info|backup|restore|reset|verify [file]'\n", fname, lineNo);
+			fclose(f);
+			return 0;
+		}
+		tasks[taskCount].seq = taskCount + 1;
+		taskCount++;
+	}
+	fclose(f);
+	if (!taskCount)
+		printf("%s: no jobs\n", fname);
+	return taskCount > 0;
+}
+
+/* an image file or a clean image (C, M, Y, K or I), returns its size or 0 */
+static int readSimImage(const char* image, BYTE* buf) {
+	int size, i;
+	FILE* f;
+	for (i = 1; image[1] == 0 && i < sizeof(imageTypes); i++) {
+		if (imageTypes[i] == (image[0] | 0x20)) {
+			memcpy(buf, cleanData[i], 512);
+			return 512;
+		}
+	}
+	f = fopen(image, "rb");
+	if (!f) {
+		printf("Error reading file '%s'\n", image);
+		return 0;
+	}
+	size = fread(buf, 1, SIM_MAX_SIZE, f);
+	fclose(f);
+	if (size != 512 && size != SIM_MAX_SIZE) {
+		printf("Error: '%s' is not a 512 or 2048 byte image\n", image);
+		return 0;
+	}
+	return size;
+}
+
+/*
+ * With -m the image is a list, one per lane, with - for an empty lane. A
+ * single image is seated on every lane. "<image>!<n>" holds SDA low for
+ * the first n clocks, "<image>@<clock>:<n>" loses power for n clocks.
+ */
+static int loadSimulator(char* image, int* ports, int nports) {
+	static BYTE buf[SIM_MAX_SIZE];
+	char name[256], *s = image, *p;
+	int size = 0, i, lane, n;
+	long hold, off, offClocks;
+	if (!opt.lanes) {
+		if (!(size = readSimImage(image, buf)))
+			return 0;
+		for (i = 0; i < nports; i++)
+			simLoad(portAddress(ports[i]), buf, size, chipIDs[findImageType(buf[0x28])]);
+		printf("Using simulated %s chip loaded from '%s'\n", size > 512 ? "24C16" : "24C04", image);
+		return 1;
+	}
+	for (lane = 0; lane < opt.lanes && *s; lane++) {
+		n = strcspn(s, ",");
+		snprintf(name, sizeof(name), "%.*s", n, s);
+		if (strchr(image, ','))
+			s += s[n] ? n + 1 : n; // the lanes past the list stay empty
+		hold = off = offClocks = 0;
+		if ((p = strchr(name, '@'))) {
+			sscanf(p + 1, "%ld:%ld", &off, &offClocks);
+			*p = 0;
+		}
+		if ((p = strchr(name, '!'))) {
+			hold = atol(p + 1);
+			*p = 0;
+		}
+		if (!strcmp(name, "-"))
+			continue;
+		if (!(size = readSimImage(name, buf)))
+			return 0;
+		for (i = 0; i < nports; i++) {
+			simLoadLane(portAddress(ports[i]), lane, buf, size, chipIDs[findImageType(buf[0x28])]);
+			simHoldSda(portAddress(ports[i]), lane, hold);
+			simPowerOff(portAddress(ports[i]), lane, off, offClocks);
+		}
+	}
+	printf("Using simulated chips on %d lanes loaded from '%s'\n", opt.lanes, image);
+	return 1;
+}
+
+/*
+ * Read a 512 or 2048 byte image, at most size bytes; returns its size or
+ * 0. "@" is the last stored backup of the cartridge with image cur,
+ * "@<id>" any stored backup.
+ */
+static int loadImage(const char* fname, const BYTE* cur, BYTE* buf, int size) {
+	FILE* f;
+	int n;
+	if (fname[0] == '@') {
+		char id[STORE_ID_LEN];
+		snprintf(id, sizeof(id), "%s", fname + 1);
+		if (!id[0] && !storeFindLast(cur, id)) {
+			msg("Error: no backup of this cartridge in '%s'\n", STORE_DIR);
+			return 0;
+		}
+		msg("Using backup %s\n", id);
+		n = storeGet(id, cleanData[findImageType(cur[0x28])], buf);
+		if (!n)
+			return 0;
+	} else {
+		f = fopen(fname, "rb");
+		if (!f) {
+			msg("Error reading file '%s'\n", fname);
+			return 0;
+		}
+		n = fread(buf, 1, 2048, f);
+		fclose(f);
+		if (n != 512 && n != 2048) {
+			msg("Error: '%s' is not a 512 or 2048 byte image\n", fname);
+			return 0;
+		}
+	}
+	if (n > size) {
+		msg("Error: '%s' is a %d byte image, use -a to access all of it\n", fname, n);
+		return 0;
+	}
+	return n;
+}
+
+/* per-port values kept in the config file as "<port>.<name>" */
+static const char* getPortString(Job* job, const char* name) {
+	char key[32];
+	snprintf(key, sizeof(key), "%s.%s", job->portName, name);
+	return cfgGet(key);
+}
+
+static int getPortValue(Job* job, const char* name, int def) {
+	const char* v = getPortString(job, name);
+	return v ? atoi(v) : def;
+}
+
+static void savePortValue(Job* job, const char* name, int value) {
+	char key[32], v[16];
+	snprintf(key, sizeof(key), "%s.%s", job->portName, name);
+	snprintf(v, sizeof(v), "%d", value);
+	cfgSet(key, v);
+	cfgSave(CONFIG_FILE);
+}
+
+static void saveLastChip(Job* job, int chipID) {
+	if (chipID == job->lastChip)
+		return;
+	job->lastChip = chipID;
+	savePortValue(job, "chip", chipID);
+}
+
+/*
+ * Find the cartridge chip, returns its chip select ID (0-3) or -1.
+ * Each ID is probed once per pass, without delays; further passes are
+ * only made while nothing answers. Given an image, the chip last seen on
+ * the port is tried first by reading the color at 0x28 into it.
+ */
+static int detectChip(Job* job, int retry, Image* img) {
+	I2CBus* bus = &job->bus;
+	const BYTE* type;
+	int pass, chipID;
+	if (img && job->lastChip >= 0 && (img->size <= 512 || !job->lastChip)) {
+		i2c_select_chip(bus, 0x20 | (job->lastChip << 2));
+		// a 24C16 answers at every ID, so the color must belong there
+		if ((type = imageProbe(img, 0x28, 1)) && chipIDs[findImageType(*type)] == job->lastChip)
+			return job->lastChip;
+		imageClear(img);
+	}
+	for (pass = 0; pass < (retry ? DETECT_RETRY : 1); pass++) {
+		if (pass)
+			SleepEx(2, 0);
+		for (chipID = 0; chipID < 4; chipID++) {
+			i2c_select_chip(bus, 0x20 | (chipID << 2));
+			// check comm.
+			if (i2c_wait_init(bus, 0)) {
+				saveLastChip(job, chipID);
+				return chipID;
+			}
+		}
+	}
+	return -1;
+}
+
+/*
+ * The chip is powered from the bus lines. Keep them high and probe every
+ * CHARGE_STEP ms until the chip answers CHARGE_ACKS probes in a row, then
+ * charge another eighth of that time as margin. Returns the charge time
+ * in ms, which is also stored for the port, or -1 if the chip stays
+ * silent. Long cables may need more than CHARGE_MAX; the limit grows to
+ * twice the longest time seen on the port.
+ */
+static int chargeChip(Job* job) {
+	long long start = timerMicros();
+	int acks = 0, ms = 0, last = getPortValue(job, "charge", 0);
+	int phase = i2c_phase(&job->bus, I2C_PHASE_CHARGE);
+	int limit = last * 2 > CHARGE_MAX ? last * 2 : CHARGE_MAX;
+	while (acks < CHARGE_ACKS && ms < limit) {
+		i2c_charge(&job->bus, CHARGE_STEP);
+		acks = detectChip(job, 0, NULL) >= 0 ? acks + 1 : 0;
+		ms = (int)((timerMicros() - start) / 1000);
+	}
+	if (acks < CHARGE_ACKS) {
+		msg("Warning: no steady answer from the chip after %d ms of charging\n", ms);
+		i2c_phase(&job->bus, phase);
+		return -1;
+	}
+	i2c_charge(&job->bus, ms / 8 + 1);
+	i2c_phase(&job->bus, phase);
+	ms = (int)((timerMicros() - start) / 1000);
+	msg("Chip ready after %d ms of charging\n", ms);
+	if (ms > last)
+		savePortValue(job, "charge", ms);
+	return ms;
+}
+
+static int saveImage(const char* fname, const BYTE* buf, int size) {
+	FILE* f;
+	msg("Saving EEPROM (%d bytes) to file '%s'\n", size, fname);
+	f = fopen(fname, "wb");
+	if (!f) {
+		msg("Error writing file '%s'\n", fname);
+		return 0;
+	}
+	fwrite(buf, size, 1, f);
+	fclose(f);
+	msg("Done.\n");
+	return 1;
+}
+
+/* compare buf with an image file, returns 1 if they match */
+static int compareImage(const char* fname, const BYTE* buf, int size) {
+	BYTE buf2[IMAGE_MAX];
+	WritePlan plan;
+	int i, n;
+	msg("Comparing EEPROM with file '%s'\n", fname);
+	if (!(n = loadImage(fname, buf, buf2, size)))
+		return 0;
+	wplanBuild(&plan, buf, buf2, n, I2C_PAGE_SIZE);
+	for (i = 0; i < plan.count; i++)
+		msg("  0x%03X-0x%03X differs\n", plan.range[i].addr, plan.range[i].addr + plan.range[i].n - 1);
+	if (plan.count) {
+		msg("Error: EEPROM differs from '%s' in %d page%s\n", fname, plan.count, plan.count == 1 ? "" : "s");
+		return 0;
+	}
+	msg("Done.\n");
+	return 1;
+}
+
+/* the fields holding the page counters of an extended update */
+static int resetOffsets[] = {0x58, 0x68, 0x78, 0x88, 0x90, 0xA0};
+static int   resetSizes[] = {   4,    4,    4,    4,    4,    6};
+#define RESET_FIELDS (sizeof(resetOffsets) / sizeof(resetOffsets[0]))
+
+/*
+ * The image buf with the page counters reset to those of clean, the
+ * clean image of its type, into want, which may be buf. Only 0xf0-0xff
+ * and the counter fields of buf need to be read. Returns 0 for an
+ * unsupported chip.
+ */
+static int resetImage(const BYTE* buf, int imageTypeID, const BYTE* clean, BYTE* want, int size) {
+	int i;
+	if (memcmp(buf + 0xf0, clean + 0xf0, 16)) {
+		msg("%s: unsupported chip type\n", opt.force ? "Warning" : "Error");
+		if (!opt.force)
+			return 0;
+	}
+	if (want != buf)
+		memcpy(want, buf, size);
+	if (extUpdate[imageTypeID]) {
+		for (i = 0; i < RESET_FIELDS; i++)
+			memcpy(want + resetOffsets[i], clean + resetOffsets[i], resetSizes[i]);
+	} else {
+		memset(want + 0x88, 0, 4);
+	}
+	return 1;
+}
+
+/* detect, read, then back up, restore and/or reset one cartridge */
+static int runTask(Job* job, const Task* task, char* summary, int len) {
+	I2CBus* bus = &job->bus;
+	Image img;
+	BYTE* buf = img.data;
+	const BYTE* field;
+	int size = opt.size;
+	int i;
+	char fname[256];
+
+	snprintf(summary, len, "no chip");
+	imageInit(&img, bus, size);
+	i2c_phase(bus, I2C_PHASE_DETECT);
+	int chipID = detectChip(job, 1, &img);
+	i2c_phase(bus, I2C_PHASE_READ);
+	if (chipID < 0) {
+		msg("Error: no response from the chip\n");
+		return 1;
+	}
+
+	if (size > 512 && chipID) {
+		msg("Error: chip at ID %d is not a 24C16, only 512 bytes are accessible\n", chipID);
+		return 1;
+	}
+
+	// backups and diffs need the whole chip, one sequential read rolling over all blocks
+	if (task->readFname || task->writeFname || task->verifyFname || (task->zeroOut && !opt.nobackup)) {
+		if (!imageAll(&img))
+			return 1;
+		if (size > 512 && !memcmp(buf, buf + 512, 512) && !memcmp(buf, buf + 1024, 1024))
+			msg("Warning: upper blocks mirror the first 512 bytes, the chip may be a 24C04\n");
+	}
+//	BYTE doubleCapacity = buf[0x4c]; // 0=No, 1=Yes (black only)
+	if (!imageFetch(&img, 0x28, 1) || !(field = imageFetch(&img, 0x88, 4)))
+		return 1;
+	int pageCount = int4((BYTE*)field); // stored at offset 0x88 (BE)
+	char imageType = buf[0x28];
+
+	int imageTypeID = findImageType(imageType);
+	msg("Chip type: '%c' (%s)\n", imageType, chipNames[imageTypeID]);
+	if (imageTypeID && chipID != chipIDs[imageTypeID])
+		msg("Warning: color stored in cartridge '%c' doesn't match cartridge color\n", imageType);
+
+	msg("Page count: %d\n", pageCount);
+	snprintf(summary, len, "%s, %d pages", chipNames[imageTypeID], pageCount);
+
+	if (task->readFname && !saveImage(jobFileName(job, task, task->readFname, fname, sizeof(fname)), buf, size))
+		return 1;
+	if (task->writeFname) {
+		BYTE buf2[IMAGE_MAX];
+		WritePlan plan;
+		int n;
+		msg("Writing EEPROM from file '%s'\n", task->writeFname);
+		if (!(n = loadImage(task->writeFname, buf, buf2, size)))
+			return 1;
+
+		wplanBuild(&plan, buf, buf2, n, I2C_PAGE_SIZE);
+		wplanPrint(&plan);
+		if (!wplanExecute(bus, &plan, buf2) || !wplanVerify(bus, &plan, buf2, VERIFY_RETRY))
+			return 1;
+		imageStore(&img, 0, buf2, n);
+		msg("Done.\n");
+	}
+	if (task->zeroOut) {
+		BYTE* buf2 = cleanData[imageTypeID];
+		BYTE want[IMAGE_MAX];
+		WritePlan plan;
+		if (!buf2) {
+			buf2 = clean_I;
+			if (!opt.force) {
+				msg("Unable to reset page counter of unknown chip\n");
+				return 1;
+			}
+		}
+		if (!task->readFname && !opt.nobackup) {
+			char id[STORE_ID_LEN];
+			if (!storePut(buf, size, cleanData[imageTypeID], time(NULL), id))
+				return 1;
+			msg("Saved EEPROM backup %s in '%s'\n", id, STORE_DIR);
+		}
+
+		msg("Zeroing out page counters\n");
+		if (!imageFetch(&img, 0xf0, 16))
+			return 1;
+		if (extUpdate[imageTypeID] && !imageFetch(&img, resetOffsets[0],
+				resetOffsets[RESET_FIELDS - 1] + resetSizes[RESET_FIELDS - 1] - resetOffsets[0]))
+			return 1;
+		if (!resetImage(buf, imageTypeID, buf2, want, size))
+			return 1;
+		// only the fields differ, whatever hasn't been read is the same in both
+		wplanBuild(&plan, buf, want, size, I2C_PAGE_SIZE);
+		if (!wplanExecute(bus, &plan, want))
+			return 1;
+		if (!wplanVerify(bus, &plan, want, VERIFY_RETRY))
+			return 1;
+		for (i = 0; i < plan.count; i++)
+			imageStore(&img, plan.range[i].addr, want + plan.range[i].addr, plan.range[i].n);
+		msg("Done.\n");
+	}
+	if (task->verifyFname && !compareImage(task->verifyFname, buf, size))
+		return 1;
+	return 0;
+}
+
+static void taskActions(const Task* task, char* actions) {
+	actions[0] = 0;
+	if (task->readFname)
+		strcat(actions, "backup+");
+	if (task->writeFname)
+		strcat(actions, "restore+");
+	if (task->zeroOut)
+		strcat(actions, "reset+");
+	if (task->verifyFname)
+		strcat(actions, "verify+");
+	if (!actions[0])
+		strcpy(actions, "info+");
+	actions[strlen(actions) - 1] = 0;
+}
+
+/* the messages of a lane get its number, -1 for the port's own */
+static void lanePrefix(Job* job, int lane) {
+	char prefix[32] = "";
+	if (opt.multiPort)
+		snprintf(prefix, sizeof(prefix), "%s: ", job->portName);
+	if (lane >= 0)
+		snprintf(prefix + strlen(prefix), sizeof(prefix) - strlen(prefix), "lane %d: ", lane + 1);
+	msgPrefix(prefix);
+}
+
+/* the chip ID of each lane of mask, each ID probed on all lanes at once */
+static int detectLanes(LaneBus* l, int mask) {
+	int id, i, found = 0;
+	for (id = 0; id < 4 && (mask & ~found); id++) {
+		for (i = 0; i < l->count; i++) {
+			if (!(found & (1 << i)))
+				l->chipID[i] = 0x20 | (id << 2);
+		}
+		found |= lanesProbe(l, mask & ~found);
+	}
+	return found;
+}
+
+/*
+ * chargeChip for all lanes. The lanes are released between transactions,
+ * so charging is waiting. Stops once the same lanes answered CHARGE_ACKS
+ * probes in a row, if some lanes are empty not before the charge time of
+ * the port. Returns the lanes with a chip.
+ */
+static int chargeLanes(Job* job, LaneBus* l) {
+	long long start = timerMicros();
+	int all = (1 << l->count) - 1, found = 0, acks = 0, ms = 0, f;
+	int last = getPortValue(job, "charge", 0);
+	int limit = last * 2 > CHARGE_MAX ? last * 2 : CHARGE_MAX;
+	int phase = i2c_phase(&job->bus, I2C_PHASE_CHARGE);
+	while ((acks < CHARGE_ACKS || (found != all && ms < last)) && ms < limit) {
+		SleepEx(CHARGE_STEP, 0);
+		f = detectLanes(l, all);
+		acks = f && f == found ? acks + 1 : 0;
+		found = f;
+		ms = (int)((timerMicros() - start) / 1000);
+	}
+	if (found) {
+		SleepEx(ms / 8 + 1, 0);
+		found = detectLanes(l, all);
+	}
+	i2c_phase(&job->bus, phase);
+	ms = (int)((timerMicros() - start) / 1000);
+	msg("Chips ready on %d of %d lanes after %d ms of charging\n", lanesCount(found), l->count, ms);
+	if (found == all && ms > last)
+		savePortValue(job, "charge", ms);
+	return found;
+}
+
+/* back up one lane's image and plan its restore and/or reset, 1 = ok */
+static int prepareLane(Job* job, const Task* task, int chipID, const BYTE* buf, BYTE* want, WritePlan* plan) {
+	int size = opt.size, n, imageTypeID = findImageType(buf[0x28]);
+	char fname[256];
+	plan->count = 0;
+	msg("Chip type: '%c' (%s)\n", buf[0x28], chipNames[imageTypeID]);
+	if (imageTypeID && ((chipID >> 2) & 3) != chipIDs[imageTypeID])
+		msg("Warning: color stored in cartridge '%c' doesn't match cartridge color\n", buf[0x28]);
+	msg("Page count: %d\n", int4((BYTE*)buf + 0x88));
+	if (task->readFname && !saveImage(jobFileName(job, task, task->readFname, fname, sizeof(fname)), buf, size))
+		return 0;
+	memcpy(want, buf, size);
+	if (task->writeFname) {
+		msg("Writing EEPROM from file '%s'\n", task->writeFname);
+		if (!(n = loadImage(task->writeFname, buf, want, size)))
+			return 0;
+		memcpy(want + n, buf + n, size - n);
+	}
+	if (task->zeroOut) {
+		const BYTE* clean = cleanData[imageTypeID];
+		if (!clean) {
+			clean = clean_I;
+			if (!opt.force) {
+				msg("Unable to reset page counter of unknown chip\n");
+				return 0;
+			}
+		}
+		if (!task->readFname && !opt.nobackup) {
+			char id[STORE_ID_LEN];
+			if (!storePut(buf, size, cleanData[imageTypeID], time(NULL), id))
+				return 0;
+			msg("Saved EEPROM backup %s in '%s'\n", id, STORE_DIR);
+		}
+		msg("Zeroing out page counters\n");
+		if (!resetImage(want, imageTypeID, clean, want, size))
+			return 0;
+	}
+	wplanBuild(plan, buf, want, size, I2C_PAGE_SIZE);
+	if (task->writeFname || task->zeroOut)
+		wplanPrint(plan);
+	return 1;
+}
+
+/*
+ * runTask for the cartridges on all lanes of the port: they are read in
+ * one pass, written in one pass with every lane at its own next cycle,
+ * then the written ranges are read back the same way to verify. Lanes
+ * that fail are retried on their own and don't hold up the others.
+ */
+static int runLaneTask(Job* job, const Task* task) {
+	I2CBus* bus = &job->bus;
+	LaneBus lanes;
+	BYTE buf[LANES_MAX][IMAGE_MAX], want[LANES_MAX][IMAGE_MAX];
+	BYTE *bufs[LANES_MAX], *wants[LANES_MAX];
+	WritePlan plan[LANES_MAX];
+	Task t = *task;
+	int size = opt.size, i, r, chips, found, ok, write = 0, pending, read;
+
+	lanesInit(&lanes, bus, opt.lanes);
+	for (i = 0; i < LANES_MAX; i++) {
+		bufs[i] = buf[i];
+		wants[i] = want[i];
+		plan[i].count = 0;
+	}
+	chips = found = chargeLanes(job, &lanes);
+	i2c_phase(bus, I2C_PHASE_READ);
+	for (i = 0; i < lanes.count; i++) {
+		lanePrefix(job, i);
+		if (!(found & (1 << i)))
+			msg("No response from the chip\n");
+		else if (size > 512 && lanes.chipID[i] != 0x20)
+			msg("Error: chip at ID %d is not a 24C16, only 512 bytes are accessible\n", (lanes.chipID[i] >> 2) & 3);
+		lanePrefix(job, -1);
+	}
+	if (size > 512) {
+		for (i = 0; i < lanes.count; i++) {
+			if (lanes.chipID[i] != 0x20)
+				found &= ~(1 << i);
+		}
+	}
+	ok = lanesRead(&lanes, found, 0, bufs, size);
+	for (i = 0; i < lanes.count; i++) {
+		if (!(found & (1 << i)))
+			continue;
+		t.lane = i + 1;
+		lanePrefix(job, i);
+		if (!(ok & (1 << i)))
+			msg("Error: reading the chip failed\n");
+		else if (!prepareLane(job, &t, lanes.chipID[i], buf[i], want[i], &plan[i]))
+			ok &= ~(1 << i);
+		else if (plan[i].count)
+			write |= 1 << i;
+		lanePrefix(job, -1);
+	}
+
+	// write, then read back and rewrite what still differs
+	pending = write ? lanesWrite(&lanes, write, plan, wants) : 0;
+	for (r = 0; pending; r++) {
+		i2c_phase(bus, I2C_PHASE_VERIFY);
+		// only the planned ranges, the rest of buf already matches want
+		read = lanesReadPlan(&lanes, pending, plan, bufs);
+		for (i = 0; i < lanes.count; i++) {
+			if (read & (1 << i)) {
+				wplanBuild(&plan[i], buf[i], want[i], size, I2C_PAGE_SIZE);
+				if (!plan[i].count) {
+					write &= ~(1 << i);
+				} else if (r < VERIFY_RETRY) {
+					lanePrefix(job, i);
+					msg("Verify: %d cycle%s differ, rewriting\n", plan[i].count, plan[i].count == 1 ? "" : "s");
+					lanePrefix(job, -1);
+				}
+			}
+		}
+		pending &= read & write;
+		if (!pending || r == VERIFY_RETRY)
+			break;
+		pending = lanesWrite(&lanes, pending, plan, wants);
+	}
+	ok &= ~write;
+	for (i = 0; i < lanes.count; i++) {
+		if (!(found & (1 << i)))
+			continue;
+		lanePrefix(job, i);
+		if (write & (1 << i)) {
+			msg("Error: writing or verifying the chip failed\n");
+		} else if (ok & (1 << i)) {
+			if (task->writeFname || task->zeroOut)
+				msg("Done.\n");
+			if (task->verifyFname && !compareImage(task->verifyFname, buf[i], size))
+				ok &= ~(1 << i);
+		}
+		lanePrefix(job, -1);
+	}
+	lanesFree(&lanes);
+	msg("%d of %d cartridges ok\n", lanesCount(ok), lanesCount(chips));
+	return !ok || ok != chips;
+}
+
+/* the tasks of the run and their bus counters, under poolLock */
+static I2CStats runStats;
+static int runTasks, runFailed;
+
+/* append a line to the -t file, called under poolLock */
+static int appendStats(const char* line) {
+	FILE* f = fopen(opt.statsFname, "a");
+	if (!f)
+		return 0;
+	fputs(line, f);
+	return !fclose(f);
+}
+
+/* append the bus statistics of a task to the -t file and start counting anew */
+static void writeStats(Job* job, const Task* task, int rc) {
+	char actions[32], stats[768], line[900];
+	int ok;
+	i2c_phase(&job->bus, I2C_PHASE_OTHER);
+	if (!opt.statsFname)
+		return;
+	taskActions(task, actions);
+	i2c_stats_json(&job->bus, stats, sizeof(stats));
+	snprintf(line, sizeof(line), "{\"port\":\"%s\",\"job\":%d,\"actions\":\"%s\",\"ok\":%s,\"bus\":%s}\n",
+			job->portName, task->seq, actions, rc ? "false" : "true", stats);
+	poolLock();
+	i2c_stats_add(&runStats, &job->bus);
+	runTasks++;
+	runFailed += rc != 0;
+	ok = appendStats(line);
+	poolUnlock();
+	i2c_stats_reset(&job->bus);
+	if (!ok)
+		msg("Error writing file '%s'\n", opt.statsFname);
+}
+
+/* append the totals of all tasks to the -t file at the end of the run */
+static void writeRunStats() {
+	char stats[768], line[900];
+	if (!opt.statsFname || !runTasks)
+		return;
+	i2c_stats_total_json(&runStats, stats, sizeof(stats));
+	snprintf(line, sizeof(line), "{\"tasks\":%d,\"failed\":%d,\"bus\":%s}\n", runTasks, runFailed, stats);
+	if (!appendStats(line))
+		printf("Error writing file '%s'\n", opt.statsFname);
+}
+
+/* write the lines captured during a task to the -g file and start anew */
+static void writeCapture(Job* job, const Task* task) {
+	char fname[256], *name;
+	if (!job->bus.capture)
+		return;
+	name = jobFileName(job, task, opt.captureFname, fname, sizeof(fname));
+	if (vcdWrite(job->bus.capture, name))
+		msg("Bus capture saved to '%s'\n", name);
+	vcdClear(job->bus.capture);
+}
+
+/* run a task and print a one-line result for batch and monitor mode */
+static int runTimedTask(Job* job, const Task* task) {
+	char summary[64], actions[32];
+	long long start = timerMicros();
+	int rc = runTask(job, task, summary, sizeof(summary));
+	writeStats(job, task, rc);
+	writeCapture(job, task);
+	taskActions(task, actions);
+	msg("Job %d: %s %s (%s) in %d ms%s\n", task->seq, actions, rc ? "FAILED" : "ok", summary,
+			(int)((timerMicros() - start) / 1000), opt.scan ? "\a" : ""); // beep when monitoring
+	return rc;
+}
+
+/*
+ * The device address that acknowledges, the last one first, or -1. A
+ * kernel adapter may share its bus with other devices, so there only the
+ * four cartridge chip select IDs are probed.
+ */
+static int probeDevice(I2CBus* bus, int last) {
+	int i, first = bus->devFd >= 0 ? 8 : 0, end = bus->devFd >= 0 ? 12 : 32;
+	if (last >= 0) {
+		i2c_select_chip(bus, last);
+		if (i2c_wait_init(bus, 0))
+			return last;
+	}
+	for (i = first; i < end; i++) {
+		// 0111 1100
+		if ((i << 2) == last)
+			continue;
+		i2c_select_chip(bus, i << 2);
+		if (i2c_wait_init(bus, 0))
+			return i << 2;
+	}
+	return -1;
+}
+
+/*
+ * Wait until two probes in a row find the port empty (present 0) or a
+ * cartridge seated (present 1), probing as often as monitorPort does.
+ * Returns the device address that answers, -1 if empty.
+ */
+static int waitCartridge(I2CBus* bus, int present) {
+	int seen = -2, interval = MONITOR_FAST;
+	for (;; SleepEx(interval, 0)) {
+		int now = probeDevice(bus, seen);
+		if (now == seen && (now >= 0) == present)
+			return now;
+		if (now < 0)
+			interval = interval * 2 < MONITOR_SLOW ? interval * 2 : MONITOR_SLOW;
+		else
+			interval = MONITOR_FAST;
+		seen = now;
+	}
+}
+
+/*
+ * Report cartridges being seated and removed, running the task on each
+ * insertion. A change needs two probes in a row to count, so bouncing
+ * contacts don't fire it. The port is probed every MONITOR_FAST ms while
+ * a cartridge is seated or just after one went, backing off to
+ * MONITOR_SLOW while it stays empty.
+ */
+static void monitorPort(Job* job, Task* task) {
+	I2CBus* bus = &job->bus;
+	int dev = -1, seen = -1, interval = MONITOR_FAST;
+	int action = opt.info || task->readFname || task->writeFname || task->zeroOut;
+
+	msg("Monitoring for cartridges... press Ctrl-C to abort.\n");
+	for (task->seq = 1;; SleepEx(interval, 0)) {
+		int now = probeDevice(bus, seen >= 0 ? seen : dev);
+		if (now == dev) {
+			seen = now;
+			if (now < 0)
+				interval = interval * 2 < MONITOR_SLOW ? interval * 2 : MONITOR_SLOW;
+			continue;
+		}
+		interval = MONITOR_FAST;
+		if (now != seen) {
+			seen = now; // first sight of a change
+			continue;
+		}
+		if (dev >= 0)
+			msg("Removed device at ID 0x%02X\n", dev);
+		if (now >= 0) {
+			msg("Inserted device at ID 0x%02X\n", now);
+			i2c_stats_reset(bus); // the idle probes don't belong to the task
+			if (bus->capture)
+				vcdClear(bus->capture);
+			if (action && chargeChip(job) >= 0) {
+				job->rc |= runTimedTask(job, task);
+				task->seq++;
+			}
+		}
+		dev = seen = now;
+	}
+}
+
+#ifndef _WIN32
+static int daemonSock = -1;
+
+/* daemon: run the requests queued for the port, one at a time */
+static void serveRequests(Job* job) {
+	int seq = 0;
+	for (;;) {
+		Request* r = queuePop(&job->queue);
+		FILE* f = requestOutput(r);
+		Task task;
+		int rc = 1;
+		msgCopy(f);
+		if (!parseTask(&task, r->line)) {
+			msg("Error: invalid request '%s', expected '<port> info|backup|restore|reset|verify [file]'\n", r->line);
+		} else {
+			task.seq = ++seq;
+			// a cartridge seated since the last request needs charging
+			if (detectChip(job, 0, NULL) < 0)
+				chargeChip(job);
+			rc = runTimedTask(job, &task);
+			free(task.readFname);
+			free(task.writeFname);
+			free(task.verifyFname);
+		}
+		msgCopy(NULL);
+		if (f)
+			fclose(f);
+		serverReply(r, rc);
+	}
+}
+
+/* daemon: hand each client request to the queue of its port */
+static void acceptRequests(void) {
+	for (;;) {
+		Request* r = serverAccept(daemonSock);
+		int i, port;
+		if (!r)
+			continue;
+		port = atoi(r->line);
+		for (i = 0; i < jobCount && jobs[i].port != port; i++)
+			;
+		if (i < jobCount) {
+			queuePush(&jobs[i].queue, r);
+		} else {
+			dprintf(r->fd, "Error: port %d is not served\n", port);
+			serverReply(r, 1);
+		}
+	}
+}
+
+#endif
+
+/* the -l profile, else the one saved for the port */
+static int selectWiring(Job* job) {
+	const char* name = opt.wiring ? opt.wiring : getPortString(job, "wiring");
+	const I2CWiring* w = i2c_wiring(0);
+	if (name && !(w = i2c_find_wiring(name))) {
+		msg("Error: unknown wiring '%s', -w lists the profiles\n", name);
+		return 0;
+	}
+	// ppdev answers control register reads from its own copy, SDA never reads low
+	if (w == i2c_wiring(0) && portBackend() == PORT_PPDEV && job->bus.devFd < 0 && !opt.lanes) {
+		msg("Error: ppdev can't read SDA back on pin 16, wire it to pin 10 as well and use -l lpt-ack\n");
+		return 0;
+	}
+	if (w == i2c_wiring(0))
+		return 1;
+	if (job->bus.devFd >= 0 || opt.gpioLines || opt.simImage) {
+		msg("Error: wiring '%s' needs a parallel port\n", name);
+		return 0;
+	}
+	i2c_set_wiring(&job->bus, w);
+	msg("Using wiring %s: %s\n", w->name, w->pins);
+	return 1;
+}
+
+static void runJob(void* arg) {
+	Job* job = arg;
+	I2CBus* bus = &job->bus;
+	int i, done;
+
+	job->rc = 1;
+	if (opt.multiPort) {
+		char prefix[16];
+		snprintf(prefix, sizeof(prefix), "%s: ", job->portName);
+		msgPrefix(prefix);
+	}
+	timerStart();
+	i2c_init(bus);
+	if (opt.i2cAdapter >= 0 && !i2cdevOpen(bus, opt.i2cAdapter))
+		goto ex1;
+	if (!selectWiring(job))
+		goto ex1;
+	i2c_setBasePort(bus, portAddress(job->port));
+	if (opt.captureFname && !(bus->capture = vcdOpen(VCD_EVENTS)))
+		msg("Warning: not enough memory for the bus capture\n");
+	job->lastChip = getPortValue(job, "chip", -1);
+	if (job->lastChip > 3)
+		job->lastChip = -1;
+	if (calibApply(bus, job->portName) && !opt.calibrate)
+		msg("Using calibrated bus timing %d/%d\n", bus->tShort, bus->tNorm);
+
+	if (opt.lanes)
+		msg("Accessing %d cartridge lanes via port %s\n", opt.lanes, job->portName);
+	else if (bus->devFd < 0)
+		msg("Accessing cartridge chip via port %s\n", job->portName);
+
+	// charge capacitor, the monitor does it on insertion, the lanes per task
+	if (!opt.scan && !opt.lanes)
+		chargeChip(job);
+
+	if (opt.calibrate) {
+		if (bus->devFd >= 0) {
+			msg("Error: the bus timing of an I2C adapter is set by its driver\n");
+			goto ex1;
+		}
+		if (detectChip(job, 1, NULL) < 0) {
+			msg("Error: no response from the chip\n");
+			goto ex1;
+		}
+		msg("Calibrating bus timing of %s\n", job->portName);
+		if (!calibRun(bus, job->portName) || !cfgSave(CONFIG_FILE))
+			goto ex1;
+	}
+
+	job->rc = 0;
+#ifndef _WIN32
+	if (opt.daemon)
+		serveRequests(job);
+#endif
+	for (i = 0, done = 0; i < taskCount; i++) {
+		if (tasks[i].port != job->port)
+			continue;
+		if (opt.scan)
+			monitorPort(job, &tasks[i]);
+		else if (opt.jobList) {
+			// the next line is the next cartridge, charged like the first
+			if (done++) {
+				msg("Job %d: remove the cartridge and insert the next one\n", tasks[i].seq);
+				waitCartridge(bus, 0);
+				waitCartridge(bus, 1);
+				i2c_stats_reset(bus); // the idle probes don't belong to the task
+				if (bus->capture)
+					vcdClear(bus->capture);
+				chargeChip(job);
+			}
+			job->rc |= runTimedTask(job, &tasks[i]);
+		} else {
+			int rc = opt.lanes ? runLaneTask(job, &tasks[i]) : runTask(job, &tasks[i], NULL, 0);
+			writeStats(job, &tasks[i], rc);
+			writeCapture(job, &tasks[i]);
+			job->rc |= rc;
+		}
+	}
+
+ex1:
+	vcdFree(bus->capture);
+	bus->capture = NULL;
+	i2cdevClose(bus);
+	i2c_free(bus);
+}
+
+/* the daemon runs the request acceptor as the job without a port */
+static void runDaemonJob(void* arg) {
+#ifndef _WIN32
+	if (!arg) {
+		acceptRequests();
+		return;
+	}
+#endif
+	runJob(arg);
+}
+
 int main(int argc, char** argv) {
 	int i, c;
-	char* readFname = NULL;
-	char* writeFname = NULL;
-	BYTE buf[512];
 	char ready = 0;
-	int port = 1;
-	int rc = 1;
-	int force = 0;
-	int nobackup = 0;
-	int zeroOut = 0;
-	int scan = 0;
-	time_t t;
-	struct tm* tm;
+	int ports[3] = { 1 }, nports = 1;
+	void* args[4];
+	int rc = 0;
 
-	printf("SSEBR For Windows version 2.0\n"
-			"Sad Samsung CLP-510 EEPROM Backup/Restore utility\n\n");
-	time(&t);
-	tm = localtime(&t);
+	opt.size = 512;
+	opt.i2cAdapter = -1;
 
-	while ((c = getopt (argc, argv, "hfiwnsp:b:r:z")) > 0) {
+	while ((c = getopt (argc, argv, "hacfiwnsp:b:r:zx:j:v:d:u:t:g:y:o:l:m:")) > 0) {
 		switch (c) {
 		case 'h':
 			break;
 		case 'w':
+			printBanner();
 			printWiring();
 			return 1;
 		case 'f':
-			force = 1;
+			opt.force = 1;
+			break;
+		case 'a':
+			opt.size = 2048;
+			break;
+		case 'c':
+			opt.calibrate = 1;
+			ready = 1;
 			break;
 		case 'i':
+			opt.info = 1;
 			ready = 1;
 			break;
-		case 'p':
-			port = atoi(optarg);
+		case 'p': {
+			char* p = optarg;
+			for (nports = 0; *p; nports++) {
+				if (nports == 3) {
+					fprintf(stderr, "%s: at most 3 ports.\n", argv[0]);
+					return 1;
+				}
+				ports[nports] = strtol(p, &p, 10);
+				if (*p == ',')
+					p++;
+				if (!portAddress(ports[nports])) {
+					fprintf(stderr, "%s: invalid port number.\n", argv[0]);
+					return 1;
+				}
+				for (i = 0; i < nports; i++) {
+					if (ports[i] == ports[nports]) {
+						fprintf(stderr, "%s: port %d given twice.\n", argv[0], ports[i]);
+						return 1;
+					}
+				}
+			}
 			break;
+		}
 		case 'b':
-			readFname = optarg;
+			opt.readFname = optarg;
 			ready = 1;
 			break;
 		case 'r':
-			writeFname = optarg;
+			opt.writeFname = optarg;
 			ready = 1;
 			break;
 		case 'z':
-			zeroOut = 1;
+			opt.zeroOut = 1;
 			ready = 1;
 			break;
 		case 's':
-			scan = 1;
+			opt.scan = 1;
 			ready = 1;
+			break;
 		case 'n':
-			nobackup = 1;
+			opt.nobackup = 1;
+			break;
+		case 'x':
+			opt.simImage = optarg;
+			break;
+		case 'j':
+			opt.jobList = optarg;
+			ready = 1;
+			break;
+		case 'v':
+			opt.verifyFname = optarg;
+			ready = 1;
+			break;
+		case 'd':
+			opt.daemon = optarg;
+			ready = 1;
+			break;
+		case 't':
+			opt.statsFname = optarg;
+			break;
+		case 'y':
+			opt.i2cAdapter = atoi(optarg);
+			break;
+		case 'o':
+			opt.gpioLines = optarg;
+			break;
+		case 'l':
+			opt.wiring = optarg;
+			break;
+		case 'm':
+			opt.lanes = atoi(optarg);
+			if (opt.lanes < 1 || opt.lanes > LANES_MAX) {
+				fprintf(stderr, "%s: 1 to %d lanes.\n", argv[0], LANES_MAX);
+				return 1;
+			}
+			break;
+		case 'g':
+			opt.captureFname = optarg;
+			break;
+		case 'u':
+			opt.client = optarg;
+			ready = 1;
 			break;
 		case '?':
 			return 1;
@@ -122,201 +1311,104 @@ int main(int argc, char** argv) {
 			return 1;
 		}
 	}
-	if (!ready) {
+	if (opt.client) {
+#ifndef _WIN32
+		return clientRun(opt.client, argc - optind, argv + optind);
+#endif
+	}
+	printBanner();
+	if (!ready || !nports || (opt.scan && opt.jobList) || (opt.daemon && (opt.scan || opt.jobList))) {
 		printUsage(argv[0]);
 		return 1;
 	}
-
-	if (!timerInit(1000000L) || !timerStart())
-		return 1;
-
-	if (!OpenPortTalk())
+	if (opt.lanes && (opt.i2cAdapter >= 0 || opt.gpioLines || opt.wiring ||
+			opt.calibrate || opt.scan || opt.jobList || opt.daemon || opt.captureFname)) {
+		fprintf(stderr, "%s: -m can't be combined with -y, -o, -l, -c, -s, -j, -d or -g.\n", argv[0]);
 		return 1;
-
-	switch (port) {
-	case 1:
-		i2c_setBasePort(0x378);
-		break;
-	case 2:
-		i2c_setBasePort(0x278);
-		break;
-	case 3:
-		i2c_setBasePort(0x3bc);
-		break;
-	default:
-		fprintf(stderr, "%s: invalid port number.\n", argv[0]);
-		goto ex1;
-	}
-
-	if (scan) {
-		printf("Scanning for I2C devices... press Ctrl-C to abort.\n");
-		do {
-			i2c_charge(100);
-			for (i = 0; i < 32; i++) {
-				// 0111 1100
-				i2c_select_chip(i << 2);
-				// check comm.
-				if (i2c_wait_init(0)) {
-					printf("Detected device at ID 0x%02X...\n", (i<<2));
-					SleepEx(500, 0);
-				}
-			}
-		} while (1);
-		rc = 0;
-		goto ex1;
 	}
-
-	// charge capacitor
-	i2c_charge(250);
-
-	printf("Accessing cartridge chip via port LPT%d\n", port);
-
-	// detect chip
-	int chipMax = 4;
-	static char* chipNames[] = {"Unknown", "ImageBelt", "Yellow", "Magenta", "Cyan", "Black"};
-	static char imageTypes[] = { 0, 'i', 'y', 'm', 'c', 'k'}; // stored at offset 0x28 and sometimes 0xE0
-	static int     chipIDs[] = { 0,   0,   0,   1,   2,   3};
-	static int   extUpdate[] = { 0,   0,   1,   1,   1,   1}; // extended update
-	static BYTE* cleanData[] = { 0, clean_I, clean_Y, clean_M, clean_C, clean_K };
-
-	int chipID;
-	for (chipID = 0; chipID < chipMax; chipID++) {
-		i2c_select_chip(0x20 | ((chipID & 3) << 2));
-		// check comm.
-		if (i2c_wait_init(1))
-			break;
-	}
-	if (chipID >= chipMax) {
-		printf("Error: no response from the chip\n");
-		goto ex1;
+#ifdef _WIN32
+	if (opt.daemon || opt.client) {
+		fprintf(stderr, "%s: -d and -u need Unix domain sockets, not available on Windows\n", argv[0]);
+		return 1;
 	}
+#else
+	if (opt.daemon && (daemonSock = serverListen(opt.daemon)) < 0)
+		return 1;
+#endif
 
-	// read chip contents
-	rc = i2c_read_bytes(0, buf, sizeof(buf));
-	if (rc < sizeof(buf)) {
-		printf("Error reading data at offset %d\n", rc);
-		goto ex1;
+	if (opt.jobList) {
+		if (!loadJobList(opt.jobList))
+			return 1;
+		for (nports = 0, i = 0; i < taskCount; i++) {
+			for (c = 0; c < nports && ports[c] != tasks[i].port; c++)
+				;
+			if (c == nports)
+				ports[nports++] = tasks[i].port;
+		}
+	} else {
+		tasks = calloc(nports, sizeof(Task));
+		for (i = 0; i < nports; i++) {
+			tasks[i].port = ports[i];
+			tasks[i].readFname = opt.readFname;
+			tasks[i].writeFname = opt.writeFname;
+			tasks[i].verifyFname = opt.verifyFname;
+			tasks[i].zeroOut = opt.zeroOut;
+		}
+		taskCount = nports;
 	}
-//	BYTE doubleCapacity = buf[0x4c]; // 0=No, 1=Yes (black only)
-	int pageCount = int4(buf+0x88); // stored at offset 0x88 (BE)
-	char imageType = buf[0x28];
 
-	int imageTypeID;
-	for (imageTypeID = 1; imageTypeID < sizeof(imageTypes); imageTypeID++) {
-		if (imageTypes[imageTypeID] == imageType)
-			break;
-	}
-	if (imageTypeID >= sizeof(imageTypes))
-		imageTypeID = 0;
-	printf("Chip type: '%c' (%s)\n", imageType, chipNames[imageTypeID]);
-	if (imageTypeID && chipID != chipIDs[imageTypeID])
-		printf("Warning: color stored in cartridge '%c' doesn't match cartridge color\n", imageType);
-
-	printf("Page count: %d\n", pageCount);
+	if (!timerInit(1000000L) || !timerStart())
+		return 1;
 
-	if (readFname) {
-		FILE* f;
-		rc = 1;
-		printf("Saving EEPROM to file '%s'\n", readFname);
-		f = fopen(readFname, "wb");
-		if (!f) {
-			printf("Error writing file '%s'\n", readFname);
-			goto ex1;
-		}
-		fwrite(buf, sizeof(buf), 1, f);
-		fclose(f);
-		printf("Done.\n");
-		rc = 0;
-	}
-	if (writeFname) {
-		BYTE buf2[sizeof(buf)];
-		FILE* f;
-		int page;
-		int pageSize = 8;
-		rc = 1;
-		printf("Writing EEPROM from file '%s'\n", writeFname);
-		f = fopen(writeFname, "rb");
-		if (!f) {
-			printf("Error reading file '%s'\n", writeFname);
-			goto ex1;
+	if (opt.i2cAdapter >= 0 || opt.gpioLines) {
+		if (nports > 1) {
+			fprintf(stderr, "%s: an I2C adapter or GPIO lines serve a single port.\n", argv[0]);
+			return 1;
 		}
-		fread(buf2, sizeof(buf2), 1, f);
-		fclose(f);
-
-		rc = 0;
-		for (page = 0; page < sizeof(buf2) && !rc; page += pageSize) {
-			for (i = 0; i < pageSize; i++) {
-				if (buf[page + i] != buf2[page + i]) {
-					if (!i2c_write_page(page + i, buf2 + page + i, pageSize - i)) {
-						printf("Error writing data at offset %d\n", page + i);
-						rc = 1;
-					}
-					break;
-				}
-			}
+#ifdef __linux__
+		if (opt.gpioLines && !gpioAttach(portAddress(ports[0]), opt.gpioLines))
+			return 1;
+#endif
+		if (opt.gpioLines && !portOpen(PORT_GPIO))
+			return 1;
+	} else if (opt.simImage) {
+		if (!loadSimulator(opt.simImage, ports, nports) || !portOpen(PORT_SIM))
+			return 1;
+	} else {
+#ifdef __linux__
+		for (i = 0; i < nports; i++) {
+			if (!ppdevAttach(portAddress(ports[i]), ports[i] - 1))
+				return 1;
 		}
-		if (!rc)
-			printf("Done.\n");
+		if (!portOpen(PORT_PPDEV))
+			return 1;
+#else
+		if (!portOpen(PORT_PORTTALK))
+			return 1;
+#endif
 	}
-	if (zeroOut) {
-		BYTE* buf2 = cleanData[imageTypeID];
-		int unknown = 0;
-		rc = 1;
-		if (!buf2) {
-			unknown = 1;
-			buf2 = clean_I;
-			if (!force) {
-				fprintf(stderr, "Unable to reset page counter of unknown chip\n");
-				goto ex1;
-			}
-		}
-		if (!readFname && !nobackup) {
-			FILE* f;
-			char backupFname[100];
-			snprintf(backupFname, sizeof(backupFname), "%s_%04d-%02d-%02d_%02d-%02d-%02d.bin", chipNames[imageTypeID], tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
-			printf("Saving EEPROM backup to %s\n", backupFname);
-			f = fopen(backupFname, "wb");
-			if (!f) {
-				printf("Error writing file '%s'\n", backupFname);
-				goto ex1;
-			}
-			if (!fwrite(buf, sizeof(buf), 1, f)) {
-				printf("Error writing file '%s'\n", backupFname);
-				fclose(f);
-				goto ex1;
-			}
-			fclose(f);
-		}
 
-		printf("Zeroing out page counters\n");
-		if (memcmp(buf + 0xf0, buf2 + 0xf0, 16)) {
-			printf("%s: unsupported chip type\n", force ? "Warning" : "Error");
-			if (!force)
-				goto ex1;
-		}
-		if (extUpdate[imageTypeID]) {
-			static int offsets[] = {0x58, 0x68, 0x78, 0x88, 0x90, 0xA0};
-			static int   sizes[] = {   4,    4,    4,    4,    4,    6};
-
-			for (i = 0; i < sizeof(offsets)/sizeof(offsets[0]); i++) {
-				if (!i2c_write_page(offsets[i], buf2 + offsets[i], sizes[i])) {
-					printf("Error writing data at offset %d\n", offsets[i]);
-					goto ex1;
-				}
-			}
-		} else {
-			static BYTE zeros[] = { 0, 0, 0, 0 };
-			if (!i2c_write_page(0x88, zeros, 4)) {
-				printf("Error writing data at offset %d\n", 0x88);
-				goto ex1;
-			}
-		}
-		printf("Done.\n");
-		rc = 0;
+	cfgLoad(CONFIG_FILE);
+	opt.multiPort = nports > 1;
+	for (i = 0; i < nports; i++) {
+		jobs[i].port = ports[i];
+		snprintf(jobs[i].portName, sizeof(jobs[i].portName),
+				opt.i2cAdapter >= 0 ? "I2C%d" : opt.gpioLines ? "GPIO%d" : opt.simImage ? "SIM%d" : "LPT%d",
+				opt.i2cAdapter >= 0 ? opt.i2cAdapter : ports[i]);
+#ifndef _WIN32
+		queueInit(&jobs[i].queue);
+#endif
+		args[i] = &jobs[i];
 	}
+	jobCount = nports;
+	args[nports] = NULL;
+	if (!poolRun(runDaemonJob, args, nports + (opt.daemon != NULL)))
+		rc = 1;
+	for (i = 0; i < nports; i++)
+		rc |= jobs[i].rc;
+	writeRunStats();
 
-ex1:
-	ClosePortTalk();
+	portClose();
 
 	return rc;
 }
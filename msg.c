@@ -0,0 +1,44 @@
+// msg.c
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "msg.h"
+
+static __thread char prefix[16];
+static __thread int lineStart = 1;
+static __thread FILE* copy;
+
+void msgPrefix(const char* p) {
+	snprintf(prefix, sizeof(prefix), "%s", p ? p : "");
+}
+
+void msgCopy(FILE* f) {
+	copy = f;
+}
+
+int msg(const char* fmt, ...) {
+	char text[512], out[1024];
+	char *s, *nl;
+	int rc, n = 0;
+	va_list ap;
+	va_start(ap, fmt);
+	rc = vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+	out[0] = 0;
+	for (s = text; *s && n < sizeof(out) - sizeof(prefix); s = nl) {
+		if (lineStart)
+			n += snprintf(out + n, sizeof(out) - n, "%s", prefix);
+		nl = strchr(s, '\n');
+		nl = nl ? nl + 1 : s + strlen(s);
+		n += snprintf(out + n, sizeof(out) - n, "%.*s", (int)(nl - s), s);
+		lineStart = nl[-1] == '\n';
+	}
+	fputs(out, stdout);
+	fflush(stdout);
+	if (copy) {
+		fputs(text, copy);
+		fflush(copy);
+	}
+	return rc;
+}
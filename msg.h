@@ -0,0 +1,22 @@
+// msg.h
+#ifndef MSG_H_
+#define MSG_H_
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* prefix for the messages of the calling thread, e.g. "LPT2: " */
+void msgPrefix(const char* prefix);
+/* also send the calling thread's messages, without prefix, to f (NULL to stop) */
+void msgCopy(FILE* f);
+/* printf that writes each line in one piece with the thread's prefix */
+int msg(const char* fmt, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSG_H_ */
@@ -0,0 +1,105 @@
+// pool.c
+
+#include <stdio.h>
+#include "port.h"
+#include "pool.h"
+
+#define POOL_MAX 8
+
+typedef struct {
+	PoolFunc fn;
+	void* arg;
+} PoolJob;
+
+#ifdef _WIN32
+
+static CRITICAL_SECTION lock;
+static int lockReady = 0; /* initialised before the first thread starts */
+
+static DWORD WINAPI poolThread(LPVOID p) {
+	PoolJob* job = p;
+	job->fn(job->arg);
+	return 0;
+}
+
+int poolRun(PoolFunc fn, void** args, int n) {
+	HANDLE threads[POOL_MAX];
+	PoolJob jobs[POOL_MAX];
+	int i, started = 0;
+	if (n == 1) {
+		fn(args[0]);
+		return 1;
+	}
+	if (!lockReady) {
+		InitializeCriticalSection(&lock);
+		lockReady = 1;
+	}
+	for (i = 0; i < n && i < POOL_MAX; i++) {
+		jobs[i].fn = fn;
+		jobs[i].arg = args[i];
+		threads[i] = CreateThread(NULL, 0, poolThread, &jobs[i], 0, NULL);
+		if (!threads[i]) {
+			fprintf(stderr, "Unable to start worker thread. Error = %08lX\n", GetLastError());
+			break;
+		}
+		started++;
+	}
+	WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+	for (i = 0; i < started; i++)
+		CloseHandle(threads[i]);
+	return started == n;
+}
+
+void poolLock(void) {
+	if (lockReady)
+		EnterCriticalSection(&lock);
+}
+
+void poolUnlock(void) {
+	if (lockReady)
+		LeaveCriticalSection(&lock);
+}
+
+#else
+
+#include <pthread.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* poolThread(void* p) {
+	PoolJob* job = p;
+	job->fn(job->arg);
+	return NULL;
+}
+
+int poolRun(PoolFunc fn, void** args, int n) {
+	pthread_t threads[POOL_MAX];
+	PoolJob jobs[POOL_MAX];
+	int i, started = 0;
+	if (n == 1) {
+		fn(args[0]);
+		return 1;
+	}
+	for (i = 0; i < n && i < POOL_MAX; i++) {
+		jobs[i].fn = fn;
+		jobs[i].arg = args[i];
+		if (pthread_create(&threads[i], NULL, poolThread, &jobs[i])) {
+			fprintf(stderr, "Unable to start worker thread\n");
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	return started == n;
+}
+
+void poolLock(void) {
+	pthread_mutex_lock(&lock);
+}
+
+void poolUnlock(void) {
+	pthread_mutex_unlock(&lock);
+}
+
+#endif
@@ -0,0 +1,21 @@
+// pool.h
+#ifndef POOL_H_
+#define POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*PoolFunc)(void* arg);
+
+/* run fn on each of the n job arguments, one thread per job, and wait for all */
+int poolRun(PoolFunc fn, void** args, int n);
+/* process-wide lock for state shared between jobs */
+void poolLock(void);
+void poolUnlock(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POOL_H_ */
@@ -0,0 +1,100 @@
+// port.c
+
+#include <stdio.h>
+#include "port.h"
+#include "sim24c16.h"
+#ifdef _WIN32
+#include "pt_ioctl.h"
+#endif
+#ifdef __linux__
+#include "ppdev.h"
+#include "gpio.h"
+#endif
+
+static int backend = -1;
+
+int portOpen(int b) {
+	switch (b) {
+	case PORT_PORTTALK:
+#ifdef _WIN32
+		if (!OpenPortTalk())
+			return 0;
+		break;
+#else
+		fprintf(stderr, "PortTalk is not available on this platform.\n");
+		return 0;
+#endif
+	case PORT_SIM:
+		break;
+	case PORT_PPDEV:
+	case PORT_GPIO:
+#ifdef __linux__
+		break;
+#else
+		fprintf(stderr, "%s is only available on Linux.\n", b == PORT_GPIO ? "GPIO" : "ppdev");
+		return 0;
+#endif
+	default:
+		fprintf(stderr, "Unknown port backend %d\n", b);
+		return 0;
+	}
+	backend = b;
+	return 1;
+}
+
+void portClose(void) {
+#ifdef _WIN32
+	if (backend == PORT_PORTTALK)
+		ClosePortTalk();
+#endif
+#ifdef __linux__
+	if (backend == PORT_PPDEV)
+		ppdevDetach();
+	if (backend == PORT_GPIO)
+		gpioDetach();
+#endif
+	backend = -1;
+}
+
+int portBackend(void) {
+	return backend;
+}
+
+void portOutb(unsigned short PortAddress, unsigned char byte) {
+	switch (backend) {
+#ifdef _WIN32
+	case PORT_PORTTALK:
+		outportb(PortAddress, byte);
+		break;
+#endif
+	case PORT_SIM:
+		simOutb(PortAddress, byte);
+		break;
+#ifdef __linux__
+	case PORT_PPDEV:
+		ppdevOutb(PortAddress, byte);
+		break;
+	case PORT_GPIO:
+		gpioOutb(PortAddress, byte);
+		break;
+#endif
+	}
+}
+
+unsigned char portInb(unsigned short PortAddress) {
+	switch (backend) {
+#ifdef _WIN32
+	case PORT_PORTTALK:
+		return inportb(PortAddress);
+#endif
+	case PORT_SIM:
+		return simInb(PortAddress);
+#ifdef __linux__
+	case PORT_PPDEV:
+		return ppdevInb(PortAddress);
+	case PORT_GPIO:
+		return gpioInb(PortAddress);
+#endif
+	}
+	return 0xff;
+}
@@ -0,0 +1,37 @@
+// port.h
+#ifndef PORT_H_
+#define PORT_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+typedef unsigned char BYTE;
+typedef unsigned long DWORD;
+DWORD SleepEx(DWORD ms, int alertable);
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* port backends */
+#define PORT_PORTTALK 0 /* PortTalk driver (32-bit Windows only) */
+#define PORT_SIM      1 /* simulated cartridge chip, see sim24c16.h */
+#define PORT_PPDEV    2 /* Linux /dev/parportN, see ppdev.h */
+#define PORT_GPIO     3 /* Linux GPIO lines, see gpio.h */
+
+int portOpen(int backend);
+void portClose(void);
+int portBackend(void);
+
+void portOutb(unsigned short PortAddress, unsigned char byte);
+unsigned char portInb(unsigned short PortAddress);
+
+#define    inp(PortAddress)         portInb(PortAddress)
+#define    outp(PortAddress, Value) portOutb(PortAddress, Value)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PORT_H_ */
@@ -0,0 +1,111 @@
+// ppdev.c
+//
+// Port backend on the Linux parport driver: /dev/parportN is claimed once
+// and each register access is one ioctl. The control register is kept in
+// a shadow copy, so a write of the value already there (i2c_send_bit sets
+// the same levels back to back) costs nothing, and reads of it come from
+// the copy: parport_pc returns its own copy of the register for
+// PPRCONTROL anyway, not the levels on the pins. The data register is
+// coalesced the same way.
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/ppdev.h>
+#include "ppdev.h"
+
+#define CONTROL_LINES 0x0f /* STROBE, AUTOFD, INIT, SELECT; bits 4-7 are not pins */
+
+typedef struct {
+	unsigned short base;
+	int fd;
+	unsigned char data, control;
+} PpDev;
+
+static PpDev devs[PPDEV_PORTS];
+static int devCount = 0;
+
+static PpDev* findDev(unsigned short port) {
+	int i;
+	for (i = 0; i < devCount; i++) {
+		if (devs[i].base == (port & ~3))
+			return &devs[i];
+	}
+	return NULL;
+}
+
+int ppdevAttach(unsigned short base, int n) {
+	char name[32];
+	PpDev* d;
+	if (devCount >= PPDEV_PORTS)
+		return 0;
+	d = &devs[devCount];
+	snprintf(name, sizeof(name), "/dev/parport%d", n);
+	d->fd = open(name, O_RDWR);
+	if (d->fd < 0) {
+		perror(name);
+		return 0;
+	}
+	ioctl(d->fd, PPEXCL); // not fatal, another driver just may share the port
+	if (ioctl(d->fd, PPCLAIM)) {
+		perror(name);
+		close(d->fd);
+		return 0;
+	}
+	ioctl(d->fd, PPRDATA, &d->data);
+	ioctl(d->fd, PPRCONTROL, &d->control);
+	d->base = base & ~3;
+	devCount++;
+	return 1;
+}
+
+void ppdevDetach(void) {
+	int i;
+	for (i = 0; i < devCount; i++) {
+		ioctl(devs[i].fd, PPRELEASE);
+		close(devs[i].fd);
+	}
+	devCount = 0;
+}
+
+void ppdevOutb(unsigned short PortAddress, unsigned char byte) {
+	PpDev* d = findDev(PortAddress);
+	if (!d)
+		return;
+	switch (PortAddress & 3) {
+	case 0:
+		if (byte != d->data && !ioctl(d->fd, PPWDATA, &byte))
+			d->data = byte;
+		break;
+	case 2:
+		byte &= CONTROL_LINES;
+		if (byte != d->control && !ioctl(d->fd, PPWCONTROL, &byte))
+			d->control = byte;
+		break;
+	}
+}
+
+unsigned char ppdevInb(unsigned short PortAddress) {
+	PpDev* d = findDev(PortAddress);
+	unsigned char b = 0xff;
+	if (!d)
+		return b;
+	switch (PortAddress & 3) {
+	case 0:
+		ioctl(d->fd, PPRDATA, &b);
+		break;
+	case 1:
+		ioctl(d->fd, PPRSTATUS, &b);
+		break;
+	case 2:
+		b = d->control;
+		break;
+	}
+	return b;
+}
+
+#endif
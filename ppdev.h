@@ -0,0 +1,28 @@
+// ppdev.h
+#ifndef PPDEV_H_
+#define PPDEV_H_
+
+#include "port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PPDEV_PORTS 4
+
+/*
+ * Claim /dev/parport<n> for the port at base address base; the port layer
+ * then routes the base, base+1 and base+2 registers to it. Linux only.
+ */
+int ppdevAttach(unsigned short base, int n);
+void ppdevDetach(void);
+
+/* LPT register access, used by the port layer */
+void ppdevOutb(unsigned short PortAddress, unsigned char byte);
+unsigned char ppdevInb(unsigned short PortAddress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PPDEV_H_ */
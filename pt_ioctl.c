@@ -13,6 +13,8 @@
 /* distributed in compiled object form only.                                  */
 /******************************************************************************/
 
+#ifdef _WIN32
+
 #include <stdio.h>
 #include "pt_ioctl.h"
 #include "porttalk_IOCTL.h"
@@ -225,3 +227,5 @@ static void InstallPortTalkDriver(SC_HANDLE SchSCManager) {
 	}
 
 }
+
+#endif /* _WIN32 */
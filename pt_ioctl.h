@@ -11,9 +11,6 @@ void ClosePortTalk(void);
 void outportb(unsigned short PortAddress, unsigned char byte);
 unsigned char inportb(unsigned short PortAddress);
 
-#define    inp(PortAddress)         inportb(PortAddress)
-#define    outp(PortAddress, Value) outportb(PortAddress, Value)
-
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,181 @@
+// server.c
+//
+// Local socket interface of the daemon (-d). A client sends one line,
+// "<port> <action> [file]" as in a job list, and receives the messages of
+// the job followed by a status line, "= ok" or "= FAILED", after which the
+// daemon closes the connection.
+
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "server.h"
+
+#define REQUEST_TIMEOUT 5 /* s a client gets to send its line */
+
+void queueInit(RequestQueue* q) {
+	q->head = q->tail = NULL;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->ready, NULL);
+}
+
+void queuePush(RequestQueue* q, Request* r) {
+	r->next = NULL;
+	pthread_mutex_lock(&q->lock);
+	if (q->tail)
+		q->tail->next = r;
+	else
+		q->head = r;
+	q->tail = r;
+	pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+}
+
+Request* queuePop(RequestQueue* q) {
+	Request* r;
+	pthread_mutex_lock(&q->lock);
+	while (!q->head)
+		pthread_cond_wait(&q->ready, &q->lock);
+	r = q->head;
+	q->head = r->next;
+	if (!q->head)
+		q->tail = NULL;
+	pthread_mutex_unlock(&q->lock);
+	return r;
+}
+
+static int socketAddress(struct sockaddr_un* sa, const char* path) {
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa->sun_path)) {
+		printf("Socket path '%s' is too long\n", path);
+		return 0;
+	}
+	strcpy(sa->sun_path, path);
+	return 1;
+}
+
+int serverListen(const char* path) {
+	struct sockaddr_un sa;
+	struct stat st;
+	mode_t mask;
+	int sock, rc;
+	if (!socketAddress(&sa, path))
+		return -1;
+	// replace the socket of an earlier daemon, nothing else
+	if (!lstat(path, &st) && !S_ISSOCK(st.st_mode)) {
+		printf("'%s' exists and is not a socket\n", path);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN); // a client that went away only fails its writes
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	// requests name files the daemon reads and writes, only the owner may send them
+	mask = umask(077);
+	rc = bind(sock, (struct sockaddr*)&sa, sizeof(sa));
+	umask(mask);
+	if (rc || listen(sock, 16)) {
+		perror(path);
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+Request* serverAccept(int sock) {
+	Request* r = calloc(1, sizeof(Request));
+	struct timeval tv = { REQUEST_TIMEOUT, 0 };
+	int n = 0, rc = 0;
+	if (!r)
+		return NULL;
+	r->fd = accept(sock, NULL, NULL);
+	if (r->fd < 0) {
+		free(r);
+		return NULL;
+	}
+	// this thread accepts for all ports, a silent client must not hold it up
+	setsockopt(r->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (n < sizeof(r->line) - 1 && (rc = read(r->fd, r->line + n, 1)) == 1 && r->line[n] != '\n')
+		n++;
+	if (rc < 0) {
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+	r->line[n] = 0;
+	return r;
+}
+
+FILE* requestOutput(Request* r) {
+	int fd = dup(r->fd);
+	FILE* f = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!f && fd >= 0)
+		close(fd);
+	return f;
+}
+
+void serverReply(Request* r, int rc) {
+	const char* status = rc ? "= FAILED\n" : "= ok\n";
+	if (write(r->fd, status, strlen(status)) < 0)
+		; // the client is gone
+	close(r->fd);
+	free(r);
+}
+
+int clientRun(const char* path, int argc, char** argv) {
+	struct sockaddr_un sa;
+	char line[512], request[REQUEST_MAX], cwd[200];
+	int sock, i, n = 0, rc = 1;
+	FILE* f;
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "expected: -u <socket> <port> <action> [file]\n");
+		return 1;
+	}
+	for (i = 0; i < argc && n < sizeof(request); i++) {
+		// the daemon may run in another directory
+		if (i == 2 && argv[i][0] != '/' && getcwd(cwd, sizeof(cwd)))
+			n += snprintf(request + n, sizeof(request) - n, " %s/%s", cwd, argv[i]);
+		else
+			n += snprintf(request + n, sizeof(request) - n, "%s%s", i ? " " : "", argv[i]);
+	}
+	if (n >= sizeof(request)) {
+		fprintf(stderr, "request too long\n");
+		return 1;
+	}
+	if (!socketAddress(&sa, path))
+		return 1;
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr*)&sa, sizeof(sa))) {
+		perror(path);
+		if (sock >= 0)
+			close(sock);
+		return 1;
+	}
+	if (write(sock, request, strlen(request)) < 0 || write(sock, "\n", 1) < 0) {
+		perror(path);
+		close(sock);
+		return 1;
+	}
+	f = fdopen(sock, "r");
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '=' && line[1] == ' ')
+			rc = strncmp(line + 2, "ok", 2) != 0;
+		else
+			fputs(line, stdout);
+	}
+	fclose(f);
+	return rc;
+}
+
+#endif /* _WIN32 */
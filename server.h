@@ -0,0 +1,56 @@
+// server.h
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REQUEST_MAX 300
+
+/* one command line from a client, answered on its connection */
+typedef struct Request {
+	int fd;
+	char line[REQUEST_MAX];
+	struct Request* next;
+} Request;
+
+/* requests waiting for one port, served in arrival order */
+typedef struct {
+	Request *head, *tail;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+} RequestQueue;
+
+void queueInit(RequestQueue* q);
+void queuePush(RequestQueue* q, Request* r);
+/* blocks until there is a request */
+Request* queuePop(RequestQueue* q);
+
+/* listening socket at path, or -1 */
+int serverListen(const char* path);
+/* wait for a client and read its request line, NULL on error */
+Request* serverAccept(int sock);
+/* stream for the messages to the client, NULL on error */
+FILE* requestOutput(Request* r);
+/* send the final status line, close the connection and free the request */
+void serverReply(Request* r, int rc);
+
+/*
+ * Send "<port> <action> [file]" from the command line to the daemon and
+ * copy its answer to stdout, returns the exit code.
+ */
+int clientRun(const char* path, int argc, char** argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _WIN32 */
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,342 @@
+// sim24c16.c
+//
+// Bit-level model of the cartridge EEPROM as seen through the LPT control
+// register. The master drives SDA on /INIT (control bit 2) and SCL on
+// /SELIN (control bit 3, inverted by the port hardware); the chip can only
+// pull SDA low. The model follows the datasheet in docs/: START/STOP
+// detection, device address with block bits, 16-byte page buffer that
+// wraps within the page, sequential reads rolling over the whole array and
+// a write cycle (tWR) during which the chip doesn't acknowledge.
+//
+// Chips can also sit on the lanes of the multi-lane wiring (lanes.h):
+// SCL on D7, SDA of lane i on D<i> and read back on a status line. The
+// data pins float high while bit 5 of the control register makes them
+// inputs, and an empty lane reads back what the master drives.
+//
+// simHoldSda and simPowerOff inject the faults the retry paths are there
+// for: a chip that keeps SDA low, one that browns out in a transfer.
+//
+// There is one chip per simulated port and lane; each is only touched by
+// the thread driving that port.
+
+#include <string.h>
+#include "utimer.h"
+#include "sim24c16.h"
+
+enum {
+	SIM_IDLE,  /* waiting for START */
+	SIM_DEV,   /* receiving device address */
+	SIM_WORD,  /* receiving word address */
+	SIM_WRITE, /* receiving page data */
+	SIM_READ   /* transmitting data */
+};
+
+typedef struct {
+	int port;
+	int lane; /* -1 on the control register, else the data bit of SDA */
+	BYTE mem[SIM_MAX_SIZE];
+	int memSize, chipSel;
+	BYTE regs[4];
+
+	int scl, sdaMaster, sdaChip;
+	int state, bit, shift, ack, readPending;
+	int addr, block;
+
+	BYTE page[SIM_PAGE_SIZE];
+	int pageBase, pageOffset, pageCount;
+
+	long writeTime;
+	long long busyUntil;
+
+	long clocks;            /* SCL rising edges seen */
+	long holdUntil;         /* SDA held low before this clock */
+	long offFrom, offUntil; /* clocks without power */
+} SimChip;
+
+#define SIM_PORTS 4
+#define SIM_CHIPS (SIM_PORTS * (SIM_LANES + 1))
+static SimChip chips[SIM_CHIPS];
+static int chipCount = 0;
+
+/* status bit and inversion of the SDA read back of each lane, as in lanes.c */
+static const int laneBit[SIM_LANES] = { 6, 7, 5, 4, 3 }, laneInv[SIM_LANES] = { 0, 1, 0, 0, 0 };
+
+static SimChip* findChip(unsigned short port, int lane) {
+	int i;
+	for (i = 0; i < chipCount; i++) {
+		if (chips[i].port == (port & ~3) && chips[i].lane == lane)
+			return &chips[i];
+	}
+	return NULL;
+}
+
+static int load(int port, int lane, const BYTE* image, int size, int sel) {
+	SimChip* c = findChip(port, lane);
+	if (size != 512 && size != SIM_MAX_SIZE)
+		return 0;
+	if (!c) {
+		if (chipCount >= SIM_CHIPS)
+			return 0;
+		c = &chips[chipCount++];
+	}
+	memset(c, 0, sizeof(*c));
+	c->port = port & ~3;
+	c->lane = lane;
+	memcpy(c->mem, image, size);
+	c->memSize = size;
+	c->chipSel = sel & 3;
+	memset(c->regs, 0xff, sizeof(c->regs));
+	c->scl = c->sdaMaster = c->sdaChip = 1;
+	c->state = SIM_IDLE;
+	c->writeTime = SIM_WRITE_TIME;
+	return 1;
+}
+
+int simLoad(int port, const BYTE* image, int size, int sel) {
+	return load(port, -1, image, size, sel);
+}
+
+int simLoadLane(int port, int lane, const BYTE* image, int size, int sel) {
+	return lane >= 0 && lane < SIM_LANES && load(port, lane, image, size, sel);
+}
+
+int simImage(int port, BYTE** image) {
+	return simLaneImage(port, -1, image);
+}
+
+int simLaneImage(int port, int lane, BYTE** image) {
+	SimChip* c = findChip(port, lane);
+	if (!c)
+		return 0;
+	*image = c->mem;
+	return c->memSize;
+}
+
+void simSetWriteTime(int port, long us) {
+	SimChip* c = findChip(port, -1);
+	if (c)
+		c->writeTime = us;
+}
+
+void simHoldSda(int port, int lane, long clocks) {
+	SimChip* c = findChip(port, lane);
+	if (c)
+		c->holdUntil = c->clocks + clocks;
+}
+
+void simPowerOff(int port, int lane, long from, long clocks) {
+	SimChip* c = findChip(port, lane);
+	if (c) {
+		c->offFrom = c->clocks + from;
+		c->offUntil = c->offFrom + clocks;
+	}
+}
+
+static int powered(SimChip* c) {
+	return c->clocks < c->offFrom || c->clocks >= c->offUntil;
+}
+
+static int sdaLine(SimChip* c) {
+	return c->sdaMaster & c->sdaChip & (c->clocks >= c->holdUntil);
+}
+
+static int busy(SimChip* c) {
+	return c->busyUntil && timerMicros() < c->busyUntil;
+}
+
+static void simStart(SimChip* c) {
+	c->state = SIM_DEV;
+	c->bit = c->shift = 0;
+	c->pageCount = 0; /* START instead of STOP aborts a page write */
+	c->sdaChip = 1;
+}
+
+static void simStop(SimChip* c) {
+	if (c->state == SIM_WRITE && c->pageCount) {
+		memcpy(c->mem + c->pageBase, c->page, SIM_PAGE_SIZE);
+		c->busyUntil = timerMicros() + c->writeTime;
+	}
+	c->state = SIM_IDLE;
+	c->sdaChip = 1;
+}
+
+/* a complete byte has been clocked in, returns the ACK */
+static int simByte(SimChip* c, int b) {
+	switch (c->state) {
+	case SIM_DEV:
+		if ((b & 0xf0) != 0xa0 || busy(c))
+			return 0;
+		if (c->memSize == 512) {
+			if (((b >> 2) & 3) != c->chipSel)
+				return 0;
+			c->block = (b >> 1) & 1;
+		} else {
+			c->block = (b >> 1) & 7;
+		}
+		if (b & 1) {
+			c->readPending = 1;
+			c->state = SIM_READ;
+		} else {
+			c->state = SIM_WORD;
+		}
+		return 1;
+	case SIM_WORD:
+		c->addr = ((c->block << 8) | b) % c->memSize;
+		c->pageBase = c->addr & ~(SIM_PAGE_SIZE - 1);
+		c->pageOffset = c->addr & (SIM_PAGE_SIZE - 1);
+		c->pageCount = 0;
+		memcpy(c->page, c->mem + c->pageBase, SIM_PAGE_SIZE);
+		c->state = SIM_WRITE;
+		return 1;
+	case SIM_WRITE:
+		c->page[c->pageOffset] = (BYTE)b;
+		c->pageOffset = (c->pageOffset + 1) & (SIM_PAGE_SIZE - 1);
+		c->pageCount++;
+		c->addr = c->pageBase + c->pageOffset;
+		return 1;
+	}
+	return 0;
+}
+
+static void loadReadByte(SimChip* c) {
+	c->shift = c->mem[c->addr];
+	c->addr = (c->addr + 1) % c->memSize;
+	c->bit = 0;
+	c->sdaChip = (c->shift >> 7) & 1;
+}
+
+/* bit counts clocks in the current byte: 0-7 data, 8 = ACK slot, 9 = after ACK */
+static void sclRise(SimChip* c) {
+	if (c->state == SIM_IDLE)
+		return;
+	if (c->state == SIM_READ && !c->readPending) {
+		if (c->bit == 8)
+			c->ack = !sdaLine(c);
+		c->bit++;
+	} else if (c->bit < 8) {
+		c->shift = (c->shift << 1) | sdaLine(c);
+		c->bit++;
+	}
+}
+
+static void sclFall(SimChip* c) {
+	if (c->state == SIM_IDLE)
+		return;
+	if (c->state == SIM_READ && !c->readPending) {
+		if (c->bit < 8) {
+			c->sdaChip = (c->shift >> (7 - c->bit)) & 1;
+		} else if (c->bit == 8) {
+			c->sdaChip = 1;
+		} else if (c->ack) {
+			loadReadByte(c);
+		} else {
+			c->state = SIM_IDLE;
+			c->sdaChip = 1;
+		}
+		return;
+	}
+	if (c->bit == 8) {
+		c->bit++;
+		if (simByte(c, c->shift & 0xff)) {
+			c->sdaChip = 0;
+		} else {
+			c->state = SIM_IDLE;
+			c->sdaChip = 1;
+		}
+	} else if (c->bit == 9) {
+		c->sdaChip = 1;
+		c->bit = c->shift = 0;
+		if (c->readPending) {
+			c->readPending = 0;
+			loadReadByte(c);
+		}
+	}
+}
+
+static void setSda(SimChip* c, int level) {
+	int old = sdaLine(c);
+	c->sdaMaster = level;
+	if (c->scl && old != sdaLine(c) && powered(c)) {
+		if (sdaLine(c))
+			simStop(c);
+		else
+			simStart(c);
+	}
+}
+
+static void setScl(SimChip* c, int level) {
+	if (level == c->scl)
+		return;
+	c->scl = level;
+	if (level)
+		c->clocks++;
+	if (!powered(c)) {
+		// forgets the transfer and lets go of SDA
+		c->state = SIM_IDLE;
+		c->sdaChip = 1;
+	} else if (level) {
+		sclRise(c);
+	} else {
+		sclFall(c);
+	}
+}
+
+static void setLines(SimChip* c, int scl, int sda) {
+	/* the lines settle in the safe order: SCL falls first, rises last */
+	if (!scl) {
+		setScl(c, 0);
+		setSda(c, sda);
+	} else {
+		setSda(c, sda);
+		setScl(c, 1);
+	}
+}
+
+/* the data pins as the lane chips see them */
+static int dataPins(const SimChip* c) {
+	return c->regs[2] & 0x20 ? 0xff : c->regs[0];
+}
+
+void simOutb(unsigned short PortAddress, unsigned char byte) {
+	int i, reg = PortAddress & 3;
+	for (i = 0; i < chipCount; i++) {
+		SimChip* c = &chips[i];
+		if (c->port != (PortAddress & ~3))
+			continue;
+		c->regs[reg] = byte;
+		if (c->lane < 0 && reg == 2)
+			setLines(c, !((byte >> 3) & 1), (byte >> 2) & 1);
+		else if (c->lane >= 0 && reg != 1)
+			setLines(c, (dataPins(c) >> 7) & 1, (dataPins(c) >> c->lane) & 1);
+	}
+}
+
+/* the status register with the SDA line of every lane */
+static BYTE laneStatus(unsigned short port, BYTE status, int pins) {
+	int i, sda;
+	for (i = 0; i < SIM_LANES; i++) {
+		SimChip* c = findChip(port, i);
+		sda = c ? sdaLine(c) : (pins >> i) & 1;
+		status = (status & ~(1 << laneBit[i])) | ((sda ^ laneInv[i]) << laneBit[i]);
+	}
+	return status;
+}
+
+unsigned char simInb(unsigned short PortAddress) {
+	SimChip* c = NULL;
+	int i, lanes = 0;
+	for (i = 0; i < chipCount; i++) {
+		if (chips[i].port != (PortAddress & ~3))
+			continue;
+		if (!c || chips[i].lane < 0)
+			c = &chips[i];
+		lanes |= chips[i].lane >= 0;
+	}
+	if (!c)
+		return 0xff;
+	if ((PortAddress & 3) == 2 && c->lane < 0)
+		return (c->regs[2] & ~0x04) | (sdaLine(c) << 2);
+	if ((PortAddress & 3) == 1 && lanes)
+		return laneStatus(PortAddress, c->regs[1], dataPins(c));
+	return c->regs[PortAddress & 3];
+}
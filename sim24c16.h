@@ -0,0 +1,41 @@
+// sim24c16.h
+#ifndef SIM24C16_H_
+#define SIM24C16_H_
+
+#include "port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_PAGE_SIZE 16
+#define SIM_MAX_SIZE 2048
+#define SIM_WRITE_TIME 5000 /* tWR in microseconds */
+#define SIM_LANES 5
+
+/*
+ * Load the simulated chip seated on the LPT port at base address port.
+ * size 2048: 24C16, answers at 1010xxx, xxx = block number.
+ * size 512:  24C04-style cartridge chip, answers at 1010 ss x where ss
+ *            is chipSel (the cartridge color ID) and x is the block number.
+ */
+int simLoad(int port, const BYTE* image, int size, int chipSel);
+/* the same for a chip on a lane of the multi-lane wiring, see lanes.h */
+int simLoadLane(int port, int lane, const BYTE* image, int size, int chipSel);
+/* current memory contents, returns the chip size */
+int simImage(int port, BYTE** image);
+int simLaneImage(int port, int lane, BYTE** image);
+void simSetWriteTime(int port, long us);
+/* faults of a chip (lane -1 for the one on the control register), in SCL clocks from now */
+void simHoldSda(int port, int lane, long clocks);
+void simPowerOff(int port, int lane, long from, long clocks);
+
+/* LPT register access, used by the port layer */
+void simOutb(unsigned short PortAddress, unsigned char byte);
+unsigned char simInb(unsigned short PortAddress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM24C16_H_ */
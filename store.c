@@ -0,0 +1,287 @@
+// store.c
+//
+// Backups kept by content: each distinct image is one file in STORE_DIR
+// named after its 64-bit FNV-1a hash, either the raw image (<id>.bin) or,
+// when that is smaller, the byte runs that differ from the clean image of
+// its color (<id>.dlt). The counters are the only difference between most
+// dumps of a cartridge, so a delta is usually a few dozen bytes.
+//
+// STORE_DIR/index.txt gets a line "<time> <serial> <id> <size>" for every
+// backup, oldest first, so the last backup of a cartridge is the last
+// line with its serial. The index is read once, into a hash table of the
+// last backup per serial that storePut keeps up to date, so a lookup
+// doesn't depend on the number of backups.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include "store.h"
+#include "pool.h"
+#include "msg.h"
+
+#define STORE_INDEX STORE_DIR "/index.txt"
+#define SERIAL_OFFSET 0x28
+#define SERIAL_LEN 16
+#define DELTA_MAGIC "SBD1"
+#define DELTA_HEADER 7 /* magic, color of the reference, size */
+
+static unsigned long long fnv1a(const BYTE* p, int n) {
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	while (n--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* the last backup of a serial, in an open addressing table */
+typedef struct {
+	char serial[SERIAL_LEN + 1]; /* empty for a free slot */
+	char id[STORE_ID_LEN];
+	int size;
+} LastBackup;
+
+static LastBackup* lastTable;
+static int lastSize, lastCount, lastLoaded;
+
+static LastBackup* lastSlot(LastBackup* table, int size, const char* serial) {
+	int i = (int)(fnv1a((const BYTE*)serial, strlen(serial)) & (size - 1));
+	while (table[i].serial[0] && strcmp(table[i].serial, serial))
+		i = (i + 1) & (size - 1);
+	return &table[i];
+}
+
+static int lastSet(const char* serial, const char* id, int size) {
+	LastBackup* e;
+	int i;
+	if ((lastCount + 1) * 2 > lastSize) {
+		int n = lastSize ? lastSize * 2 : 1024;
+		LastBackup* t = calloc(n, sizeof(LastBackup));
+		if (!t)
+			return 0;
+		for (i = 0; i < lastSize; i++) {
+			if (lastTable[i].serial[0])
+				*lastSlot(t, n, lastTable[i].serial) = lastTable[i];
+		}
+		free(lastTable);
+		lastTable = t;
+		lastSize = n;
+	}
+	e = lastSlot(lastTable, lastSize, serial);
+	if (!e->serial[0]) {
+		strcpy(e->serial, serial);
+		lastCount++;
+	}
+	strcpy(e->id, id);
+	e->size = size;
+	return 1;
+}
+
+/* read the index into the table, once; called under poolLock */
+static void lastLoad(void) {
+	char line[128], s[64], i[32];
+	int n;
+	FILE* f;
+	if (lastLoaded)
+		return;
+	lastLoaded = 1;
+	f = fopen(STORE_INDEX, "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%*s %63s %31s %d", s, i, &n) == 3 && strlen(s) <= SERIAL_LEN && strlen(i) == STORE_ID_LEN - 1)
+			lastSet(s, i, n);
+	}
+	fclose(f);
+}
+
+/* printable serial number, as one word */
+static void serialOf(const BYTE* image, char* out) {
+	int i;
+	for (i = 0; i < SERIAL_LEN && image[SERIAL_OFFSET + i] && image[SERIAL_OFFSET + i] != 0xff; i++) {
+		BYTE c = image[SERIAL_OFFSET + i];
+		out[i] = c > ' ' && c < 0x7f ? c : '_';
+	}
+	if (!i)
+		out[i++] = '-';
+	out[i] = 0;
+}
+
+/* the byte expected where the clean image ends, as in an erased chip */
+static BYTE refByte(const BYTE* clean, int i) {
+	return clean && i < 512 ? clean[i] : 0xff;
+}
+
+/* runs of at most 255 bytes that differ from the reference, returns the length */
+static int deltaEncode(const BYTE* image, int size, const BYTE* clean, BYTE* out) {
+	int i = 0, n = DELTA_HEADER, run;
+	memcpy(out, DELTA_MAGIC, 4);
+	out[4] = clean ? clean[SERIAL_OFFSET] : 0;
+	out[5] = size >> 8;
+	out[6] = size & 0xff;
+	while (i < size) {
+		if (image[i] == refByte(clean, i)) {
+			i++;
+			continue;
+		}
+		for (run = 0; i + run < size && run < 255 && image[i + run] != refByte(clean, i + run); run++)
+			;
+		if (n + 3 + run > size)
+			return size + 1; // no gain
+		out[n++] = i >> 8;
+		out[n++] = i & 0xff;
+		out[n++] = run;
+		memcpy(out + n, image + i, run);
+		n += run;
+		i += run;
+	}
+	return n;
+}
+
+static int deltaDecode(const BYTE* in, int n, const BYTE* clean, BYTE* image) {
+	int i, size, pos = DELTA_HEADER;
+	if (n < DELTA_HEADER || memcmp(in, DELTA_MAGIC, 4))
+		return 0;
+	if (in[4] && (!clean || clean[SERIAL_OFFSET] != in[4])) {
+		msg("Error: the backup is a delta against the '%c' clean image\n", in[4]);
+		return 0;
+	}
+	size = (in[5] << 8) | in[6];
+	if (size != 512 && size != 2048)
+		return 0;
+	for (i = 0; i < size; i++)
+		image[i] = refByte(in[4] ? clean : NULL, i);
+	while (pos + 3 <= n) {
+		int addr = (in[pos] << 8) | in[pos + 1], run = in[pos + 2];
+		pos += 3;
+		if (addr + run > size || pos + run > n)
+			return 0;
+		memcpy(image + addr, in + pos, run);
+		pos += run;
+	}
+	return pos == n ? size : 0;
+}
+
+static void objectName(char* fname, int len, const char* id, const char* ext) {
+	snprintf(fname, len, "%s/%s.%s", STORE_DIR, id, ext);
+}
+
+static int exists(const char* fname) {
+	FILE* f = fopen(fname, "rb");
+	if (f)
+		fclose(f);
+	return f != NULL;
+}
+
+static int makeDir(const char* dir) {
+#ifdef _WIN32
+	int rc = _mkdir(dir);
+#else
+	int rc = mkdir(dir, 0777);
+#endif
+	return !rc || errno == EEXIST;
+}
+
+static int writeObject(const BYTE* image, int size, const BYTE* clean, const char* id) {
+	BYTE delta[2048 + DELTA_HEADER + 3];
+	char fname[64];
+	int n = deltaEncode(image, size, clean, delta);
+	FILE* f;
+	objectName(fname, sizeof(fname), id, n < size ? "dlt" : "bin");
+	f = fopen(fname, "wb");
+	if (!f) {
+		msg("Error writing file '%s'\n", fname);
+		return 0;
+	}
+	n = n < size ? fwrite(delta, n, 1, f) : fwrite(image, size, 1, f);
+	if (fclose(f) || !n) {
+		msg("Error writing file '%s'\n", fname);
+		remove(fname);
+		return 0;
+	}
+	return 1;
+}
+
+int storePut(const BYTE* image, int size, const BYTE* clean, time_t t, char* id) {
+	char fname[64], serial[SERIAL_LEN + 1];
+	struct tm* tm;
+	FILE* f;
+	int rc = 0;
+	snprintf(id, STORE_ID_LEN, "%016llx", fnv1a(image, size));
+	serialOf(image, serial);
+	poolLock();
+	if (!makeDir(STORE_DIR)) {
+		msg("Error creating directory '%s'\n", STORE_DIR);
+		goto ex;
+	}
+	objectName(fname, sizeof(fname), id, "bin");
+	if (!exists(fname)) {
+		objectName(fname, sizeof(fname), id, "dlt");
+		if (!exists(fname) && !writeObject(image, size, clean, id))
+			goto ex;
+	}
+	f = fopen(STORE_INDEX, "a");
+	if (!f) {
+		msg("Error writing file '%s'\n", STORE_INDEX);
+		goto ex;
+	}
+	tm = localtime(&t);
+	fprintf(f, "%04d-%02d-%02d_%02d-%02d-%02d %s %s %d\n", tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday,
+			tm->tm_hour, tm->tm_min, tm->tm_sec, serial, id, size);
+	rc = !fclose(f);
+	if (rc) {
+		lastLoad();
+		lastSet(serial, id, size);
+	}
+ex:
+	poolUnlock();
+	return rc;
+}
+
+int storeFindLast(const BYTE* image, char* id) {
+	char serial[SERIAL_LEN + 1];
+	LastBackup* e;
+	int size = 0;
+	serialOf(image, serial);
+	poolLock();
+	lastLoad();
+	if (lastSize && (e = lastSlot(lastTable, lastSize, serial))->serial[0]) {
+		strcpy(id, e->id);
+		size = e->size;
+	}
+	poolUnlock();
+	return size;
+}
+
+int storeGet(const char* id, const BYTE* clean, BYTE* image) {
+	BYTE data[2048 + DELTA_HEADER + 3];
+	char fname[64], check[STORE_ID_LEN];
+	int n, size;
+	FILE* f;
+	objectName(fname, sizeof(fname), id, "bin");
+	f = fopen(fname, "rb");
+	if (f) {
+		size = fread(image, 1, 2048, f);
+	} else {
+		objectName(fname, sizeof(fname), id, "dlt");
+		if (!(f = fopen(fname, "rb"))) {
+			msg("Error: no backup %s in '%s'\n", id, STORE_DIR);
+			return 0;
+		}
+		n = fread(data, 1, sizeof(data), f);
+		size = deltaDecode(data, n, clean, image);
+	}
+	fclose(f);
+	snprintf(check, sizeof(check), "%016llx", fnv1a(image, size));
+	if ((size != 512 && size != 2048) || strcmp(check, id)) {
+		msg("Error: backup '%s' is damaged\n", fname);
+		return 0;
+	}
+	return size;
+}
@@ -0,0 +1,32 @@
+// store.h
+#ifndef STORE_H_
+#define STORE_H_
+
+#include <time.h>
+#include "port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STORE_DIR "backups"
+#define STORE_ID_LEN 17 /* 16 hex digits of the content hash and a 0 */
+
+/*
+ * Store an image under its content hash, unless the store already has
+ * it, and add it to the index under the serial number at 0x28 and the
+ * time. clean is the reference image for the color (512 bytes, may be
+ * NULL); an image close to it is stored as a delta. Returns 1 and the
+ * object ID in id on success.
+ */
+int storePut(const BYTE* image, int size, const BYTE* clean, time_t t, char* id);
+/* ID and size of the last backup of the cartridge with this image, 0 if none */
+int storeFindLast(const BYTE* image, char* id);
+/* load a stored image, checking its hash, returns its size or 0 */
+int storeGet(const char* id, const BYTE* clean, BYTE* image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STORE_H_ */
@@ -1,20 +1,114 @@
 // utimer.c
+//
+// Bus edges are scheduled against absolute deadlines: every timerWait ends
+// a whole number of ticks after the deadline of the previous one, so the
+// time spent in the port access between two waits is part of the phase
+// instead of being added to it. A wait that starts late doesn't wait at
+// all, and one that starts more than a phase late (the bus was idle)
+// restarts the schedule from now.
 
-#include <windows.h>
 #include <stdio.h>
+#include "port.h"
 #include "utimer.h"
 
+static long long clockFreq; /* clock units per second */
+
+#ifdef _WIN32
+
+static int clockInit() {
+	LARGE_INTEGER f;
+	f.QuadPart = 0;
+	QueryPerformanceFrequency(&f);
+	clockFreq = f.QuadPart;
+	return clockFreq > 0;
+}
+
+static long long clockNow() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+#else
+
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(UTIMER_NO_TSC)
+#define UTIMER_TSC
+#include <cpuid.h>
+#include <x86intrin.h>
+static int useTsc = 0;
+#endif
+
+static long long rawNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#ifdef UTIMER_TSC
+/* invariant TSC: constant rate in all P- and C-states */
+static int tscInvariant() {
+	unsigned int a, b, c, d;
+	if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+		return 0;
+	__get_cpuid(0x80000007, &a, &b, &c, &d);
+	return (d >> 8) & 1;
+}
+
+static void tscCalibrate() {
+	long long t0, t1, c0, c1;
+	t0 = rawNanos();
+	c0 = __rdtsc();
+	do {
+		t1 = rawNanos();
+	} while (t1 - t0 < 5000000);
+	c1 = __rdtsc();
+	clockFreq = (c1 - c0) * 1000000000LL / (t1 - t0);
+	useTsc = 1;
+}
+#endif
+
+static int clockInit() {
+	struct timespec res;
+	if (clock_getres(CLOCK_MONOTONIC_RAW, &res) || res.tv_sec || res.tv_nsec > 1000)
+		return 0;
+	clockFreq = 1000000000LL;
+#ifdef UTIMER_TSC
+	if (!useTsc && tscInvariant())
+		tscCalibrate();
+#endif
+	return 1;
+}
+
+static long long clockNow() {
+#ifdef UTIMER_TSC
+	if (useTsc)
+		return __rdtsc();
+#endif
+	return rawNanos();
+}
+
+DWORD SleepEx(DWORD ms, int alertable) {
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts))
+		;
+	return 0;
+}
+
+#endif
+
 static long long freqDivisor;
-static LARGE_INTEGER timerLast, timerCurrent;
+static __thread long long timerLast; /* deadline of the last wait, per bus thread */
+static __thread long long timerSpin; /* clock units spent waiting, per bus thread */
 
 int timerInit(long freq) {
-	timerCurrent.QuadPart = 0;
-	QueryPerformanceFrequency(&timerCurrent);
-	if (timerCurrent.QuadPart < freq * 2) {
+	if (!clockInit() || clockFreq < freq * 2LL) {
 		fprintf(stderr, "A high-performance timer is not available on this system.\n");
 		return 0;
 	}
-	freqDivisor = timerCurrent.QuadPart / freq;
+	freqDivisor = clockFreq / freq;
 	return 1;
 }
 
@@ -22,24 +116,42 @@ long long timerFreqDivisor() {
 	return freqDivisor;
 }
 
+long long timerNanos() {
+	long long now = clockNow();
+	return now / clockFreq * 1000000000LL + now % clockFreq * 1000000000LL / clockFreq;
+}
+
+long long timerMicros() {
+	return timerNanos() / 1000;
+}
+
 int timerStart() {
-	if (!QueryPerformanceCounter(&timerCurrent)) {
-		fprintf(stderr, "QueryPerformanceCounter failed\n");
-		return 0;
-	}
-	timerLast.QuadPart = timerCurrent.QuadPart;
+	timerLast = clockNow();
 	return 1;
 }
 
 void timerStep() {
-	do {
-		QueryPerformanceCounter(&timerCurrent);
-	} while (timerCurrent.QuadPart - timerLast.QuadPart < freqDivisor);
-	timerLast.QuadPart = timerCurrent.QuadPart;
+	timerLast += freqDivisor;
+	while (clockNow() < timerLast)
+		;
 }
 
 void timerWait(int ticks) {
-	timerStart();
-	while (ticks-- > 0)
-		timerStep();
+	long long phase = ticks * freqDivisor;
+	long long now = clockNow();
+	long long deadline = timerLast + phase;
+	if (now - deadline > phase) {
+		deadline = now + phase;
+	} else if (now >= deadline) {
+		timerLast = now;
+		return;
+	}
+	timerSpin += deadline - now;
+	while ((now = clockNow()) < deadline)
+		;
+	timerLast = deadline;
+}
+
+long long timerSpinNanos() {
+	return timerSpin / clockFreq * 1000000000LL + timerSpin % clockFreq * 1000000000LL / clockFreq;
 }
@@ -6,9 +6,15 @@ extern "C" {
 
 int timerInit(long freq);
 long long timerFreqDivisor();
+/* monotonic time in nanoseconds and microseconds */
+long long timerNanos();
+long long timerMicros();
 int timerStart();
 void timerStep();
+/* wait until ticks after the deadline of the previous wait */
 void timerWait(int ticks);
+/* time the calling thread has spent spinning in timerWait */
+long long timerSpinNanos();
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,165 @@
+// vcd.c
+//
+// Logic analyzer in software: every register write and SDA sample of a
+// bus is timestamped into a ring buffer, which is written out as a VCD
+// file for GTKWave or sigrok. The decode signal follows the host's view
+// of the lines, a bit is the SDA sample taken while SCL was high, or the
+// level the host drove if it didn't sample.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vcd.h"
+#include "utimer.h"
+#include "msg.h"
+
+#define EV_OUT 0 /* value: SCL << 1 | SDA */
+#define EV_IN 1  /* value: SDA */
+
+typedef struct {
+	long long t;
+	unsigned char kind, value;
+} VcdEvent;
+
+struct VcdCapture {
+	VcdEvent* ev;
+	int size, head, count;
+};
+
+VcdCapture* vcdOpen(int events) {
+	VcdCapture* cap = calloc(1, sizeof(*cap));
+	if (!cap || !(cap->ev = malloc(events * sizeof(VcdEvent)))) {
+		free(cap);
+		return NULL;
+	}
+	cap->size = events;
+	return cap;
+}
+
+void vcdFree(VcdCapture* cap) {
+	if (cap)
+		free(cap->ev);
+	free(cap);
+}
+
+void vcdClear(VcdCapture* cap) {
+	cap->head = cap->count = 0;
+}
+
+static void add(VcdCapture* cap, int kind, int value) {
+	VcdEvent* e = &cap->ev[cap->head];
+	e->t = timerNanos();
+	e->kind = kind;
+	e->value = value;
+	if (++cap->head == cap->size)
+		cap->head = 0;
+	if (cap->count < cap->size)
+		cap->count++;
+}
+
+void vcdOut(VcdCapture* cap, int scl, int sda) {
+	add(cap, EV_OUT, (scl << 1) | sda);
+}
+
+void vcdIn(VcdCapture* cap, int sda) {
+	add(cap, EV_IN, sda);
+}
+
+/* bus decoder state */
+typedef struct {
+	int scl, sda;
+	int frame;   /* between START and STOP */
+	int bitOpen; /* SCL high for a data bit */
+	int sample;  /* SDA sampled while SCL high, -1 if not */
+	int bits, byte;
+} Decoder;
+
+/* feed one event, returns the annotation it completes or NULL */
+static const char* decode(Decoder* d, const VcdEvent* e, char* text) {
+	const char* note = NULL;
+	int scl, sda;
+	if (e->kind == EV_IN) {
+		if (d->scl)
+			d->sample = e->value;
+		return NULL;
+	}
+	scl = e->value >> 1;
+	sda = e->value & 1;
+	if (d->scl && scl && sda != d->sda) {
+		// SDA changing while SCL is high
+		d->frame = !sda;
+		d->bitOpen = 0;
+		d->bits = d->byte = 0;
+		note = sda ? "STOP" : "START";
+	} else if (!d->scl && scl) {
+		d->bitOpen = 1;
+		d->sample = -1;
+	} else if (d->scl && !scl && d->bitOpen && d->frame) {
+		int bit = d->sample >= 0 ? d->sample : d->sda;
+		d->bitOpen = 0;
+		if (++d->bits <= 8) {
+			d->byte = (d->byte << 1) | bit;
+			if (d->bits == 8) {
+				sprintf(text, "0x%02X", d->byte);
+				note = text;
+			}
+		} else {
+			d->bits = d->byte = 0;
+			note = bit ? "NACK" : "ACK";
+		}
+	}
+	d->scl = scl;
+	d->sda = sda;
+	return note;
+}
+
+int vcdWrite(VcdCapture* cap, const char* fname) {
+	Decoder d = { 1, 1, 0, 0, -1, 0, 0 };
+	int i, first, scl = 1, sda = 1, in = -1;
+	long long t0, last = 0;
+	const char* note;
+	char text[8];
+	time_t now = time(NULL);
+	FILE* f = fopen(fname, "w");
+	if (!f) {
+		msg("Error writing file '%s'\n", fname);
+		return 0;
+	}
+	fprintf(f, "$date %.24s $end\n$version ssebr2 $end\n$timescale 1ns $end\n"
+			"$scope module i2c $end\n"
+			"$var wire 1 ! scl $end\n$var wire 1 \" sda $end\n$var wire 1 # sda_in $end\n"
+			"$var string 1 $ decode $end\n"
+			"$upscope $end\n$enddefinitions $end\n"
+			"#0\n$dumpvars\n1!\n1\"\nx#\nsidle $\n$end\n", ctime(&now));
+	first = cap->count < cap->size ? 0 : cap->head;
+	t0 = cap->ev[first].t;
+	for (i = 0; i < cap->count; i++) {
+		const VcdEvent* e = &cap->ev[(first + i) % cap->size];
+		int changed = e->kind == EV_IN ? e->value != in
+				: (e->value >> 1) != scl || (e->value & 1) != sda;
+		note = decode(&d, e, text);
+		if (!changed && !note)
+			continue;
+		if (e->t - t0 != last) {
+			last = e->t - t0;
+			fprintf(f, "#%lld\n", last);
+		}
+		if (e->kind == EV_IN) {
+			if (e->value != in)
+				fprintf(f, "%d#\n", in = e->value);
+		} else {
+			if ((e->value >> 1) != scl)
+				fprintf(f, "%d!\n", scl = e->value >> 1);
+			if ((e->value & 1) != sda)
+				fprintf(f, "%d\"\n", sda = e->value & 1);
+		}
+		if (note)
+			fprintf(f, "s%s $\n", note);
+	}
+	if (fclose(f)) {
+		msg("Error writing file '%s'\n", fname);
+		return 0;
+	}
+	return 1;
+}
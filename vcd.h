@@ -0,0 +1,32 @@
+// vcd.h
+#ifndef VCD_H_
+#define VCD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VCD_EVENTS (1 << 18) /* default ring size, a 2 KB read takes about 100000 */
+
+/* timestamped line events of one bus, the oldest overwritten when full */
+typedef struct VcdCapture VcdCapture;
+
+VcdCapture* vcdOpen(int events);
+void vcdFree(VcdCapture* cap);
+void vcdClear(VcdCapture* cap);
+/* the host drove SCL and SDA to these levels */
+void vcdOut(VcdCapture* cap, int scl, int sda);
+/* the host sampled SDA */
+void vcdIn(VcdCapture* cap, int sda);
+/*
+ * Write the captured events as a VCD file with the signals scl, sda
+ * (as driven by the host), sda_in (as sampled) and a decode string with
+ * START, STOP, bytes and ACK/NACK. Returns 1 on success.
+ */
+int vcdWrite(VcdCapture* cap, const char* fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VCD_H_ */
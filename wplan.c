@@ -0,0 +1,82 @@
+// wplan.c
+//
+// The chip latches up to one page per write cycle, and a write cycle costs
+// milliseconds while shifting a byte costs microseconds. So every page with
+// a difference gets exactly one cycle covering its first to last dirty byte;
+// unchanged bytes in between are rewritten with their current value.
+
+#include <stdio.h>
+#include <string.h>
+#include "i2c_comm.h"
+#include "wplan.h"
+#include "msg.h"
+
+void wplanBuild(WritePlan* plan, const BYTE* cur, const BYTE* want, int size, int pageSize) {
+	int page, i, first, last;
+	plan->count = plan->bytes = 0;
+	for (page = 0; page < size && plan->count < WPLAN_MAX; page += pageSize) {
+		first = last = -1;
+		for (i = page; i < page + pageSize && i < size; i++) {
+			if (cur[i] != want[i]) {
+				if (first < 0)
+					first = i;
+				last = i;
+			}
+		}
+		if (first < 0)
+			continue;
+		plan->range[plan->count].addr = first;
+		plan->range[plan->count].n = last - first + 1;
+		plan->bytes += last - first + 1;
+		plan->count++;
+	}
+}
+
+void wplanPrint(const WritePlan* plan) {
+	int i;
+	msg("Write plan: %d cycle%s, %d byte%s\n", plan->count, plan->count == 1 ? "" : "s",
+			plan->bytes, plan->bytes == 1 ? "" : "s");
+	for (i = 0; i < plan->count; i++)
+		msg("  0x%03X-0x%03X (%d)\n", plan->range[i].addr,
+				plan->range[i].addr + plan->range[i].n - 1, plan->range[i].n);
+}
+
+int wplanExecute(I2CBus* bus, const WritePlan* plan, BYTE* want) {
+	int i, phase = i2c_phase(bus, I2C_PHASE_WRITE);
+	for (i = 0; i < plan->count; i++) {
+		const WriteRange* r = &plan->range[i];
+		if (!i2c_write_page(bus, r->addr, want + r->addr, r->n)) {
+			msg("Error writing data at offset %d\n", r->addr);
+			break;
+		}
+	}
+	i2c_phase(bus, phase);
+	return i == plan->count;
+}
+
+static int verifyRange(I2CBus* bus, const WriteRange* r, const BYTE* want) {
+	BYTE tmp[I2C_PAGE_SIZE];
+	return i2c_read_bytes(bus, r->addr, tmp, r->n) == r->n && !memcmp(tmp, want + r->addr, r->n);
+}
+
+int wplanVerify(I2CBus* bus, const WritePlan* plan, BYTE* want, int retry) {
+	int i, j, ok, failed = 0, phase = i2c_phase(bus, I2C_PHASE_VERIFY);
+	char rewrites[24];
+	for (i = 0; i < plan->count; i++) {
+		const WriteRange* r = &plan->range[i];
+		ok = verifyRange(bus, r, want);
+		for (j = 0; !ok && j < retry; j++) {
+			if (i2c_write_page(bus, r->addr, want + r->addr, r->n))
+				ok = verifyRange(bus, r, want);
+		}
+		// one msg call per line, or lines of other ports get in between
+		if (j)
+			snprintf(rewrites, sizeof(rewrites), " (%d rewrite%s)", j, j == 1 ? "" : "s");
+		else
+			rewrites[0] = 0;
+		msg("Verify 0x%03X-0x%03X: %s%s\n", r->addr, r->addr + r->n - 1, ok ? "ok" : "FAILED", rewrites);
+		failed += !ok;
+	}
+	i2c_phase(bus, phase);
+	return !failed;
+}
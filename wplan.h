@@ -0,0 +1,40 @@
+// wplan.h
+#ifndef WPLAN_H_
+#define WPLAN_H_
+
+#include "i2c_comm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WPLAN_MAX 128 /* 2048 bytes / 16-byte pages */
+
+typedef struct {
+	int addr;
+	int n;
+} WriteRange;
+
+/* one range per write cycle, never crossing a page boundary */
+typedef struct {
+	int count;
+	int bytes;
+	WriteRange range[WPLAN_MAX];
+} WritePlan;
+
+/* plan the write cycles turning image cur into want */
+void wplanBuild(WritePlan* plan, const BYTE* cur, const BYTE* want, int size, int pageSize);
+void wplanPrint(const WritePlan* plan);
+/* execute the plan, returns 1 on success */
+int wplanExecute(I2CBus* bus, const WritePlan* plan, BYTE* want);
+/*
+ * Read back only the planned ranges and rewrite the ones that don't match,
+ * up to retry times. Prints the result per range, returns 1 if all passed.
+ */
+int wplanVerify(I2CBus* bus, const WritePlan* plan, BYTE* want, int retry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WPLAN_H_ */